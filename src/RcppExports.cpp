@@ -22,6 +22,83 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// C_get_nthreads
+int C_get_nthreads();
+RcppExport SEXP _Rnmr1D_C_get_nthreads() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(C_get_nthreads());
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_set_nthreads
+int C_set_nthreads(int n);
+RcppExport SEXP _Rnmr1D_C_set_nthreads(SEXP nSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< int >::type n(nSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_set_nthreads(n));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_perf_enable
+int C_perf_enable(int mode);
+RcppExport SEXP _Rnmr1D_C_perf_enable(SEXP modeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< int >::type mode(modeSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_perf_enable(mode));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_perf_record
+void C_perf_record(std::string name, double wall, double cpu, double bytes, double count);
+RcppExport SEXP _Rnmr1D_C_perf_record(SEXP nameSEXP, SEXP wallSEXP, SEXP cpuSEXP, SEXP bytesSEXP, SEXP countSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type name(nameSEXP);
+    Rcpp::traits::input_parameter< double >::type wall(wallSEXP);
+    Rcpp::traits::input_parameter< double >::type cpu(cpuSEXP);
+    Rcpp::traits::input_parameter< double >::type bytes(bytesSEXP);
+    Rcpp::traits::input_parameter< double >::type count(countSEXP);
+    C_perf_record(name, wall, cpu, bytes, count);
+    return R_NilValue;
+END_RCPP
+}
+// C_perf_count
+void C_perf_count(std::string name, double n);
+RcppExport SEXP _Rnmr1D_C_perf_count(SEXP nameSEXP, SEXP nSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type name(nameSEXP);
+    Rcpp::traits::input_parameter< double >::type n(nSEXP);
+    C_perf_count(name, n);
+    return R_NilValue;
+END_RCPP
+}
+// C_perf_get
+SEXP C_perf_get();
+RcppExport SEXP _Rnmr1D_C_perf_get() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(C_perf_get());
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_perf_trace
+SEXP C_perf_trace();
+RcppExport SEXP _Rnmr1D_C_perf_trace() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(C_perf_trace());
+    return rcpp_result_gen;
+END_RCPP
+}
 // C_write_pack
 void C_write_pack(SEXP x, double pmin, double pmax, SEXP ff);
 RcppExport SEXP _Rnmr1D_C_write_pack(SEXP xSEXP, SEXP pminSEXP, SEXP pmaxSEXP, SEXP ffSEXP) {
@@ -46,6 +123,164 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// C_hash_files
+std::string C_hash_files(CharacterVector files, std::string s);
+RcppExport SEXP _Rnmr1D_C_hash_files(SEXP filesSEXP, SEXP sSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type files(filesSEXP);
+    Rcpp::traits::input_parameter< std::string >::type s(sSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_hash_files(files, s));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_read_jdf
+SEXP C_read_jdf(CharacterVector files);
+RcppExport SEXP _Rnmr1D_C_read_jdf(SEXP filesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type files(filesSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_read_jdf(files));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_read_nmrml
+SEXP C_read_nmrml(std::string fname);
+RcppExport SEXP _Rnmr1D_C_read_nmrml(SEXP fnameSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type fname(fnameSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_read_nmrml(fname));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_find_rawfiles
+SEXP C_find_rawfiles(std::string root, CharacterVector suffixes, bool leaf, std::string subdir);
+RcppExport SEXP _Rnmr1D_C_find_rawfiles(SEXP rootSEXP, SEXP suffixesSEXP, SEXP leafSEXP, SEXP subdirSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type root(rootSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type suffixes(suffixesSEXP);
+    Rcpp::traits::input_parameter< bool >::type leaf(leafSEXP);
+    Rcpp::traits::input_parameter< std::string >::type subdir(subdirSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_find_rawfiles(root, suffixes, leaf, subdir));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_specstore_create
+SEXP C_specstore_create(SEXP x, std::string path);
+RcppExport SEXP _Rnmr1D_C_specstore_create(SEXP xSEXP, SEXP pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_specstore_create(x, path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_specstore_attach
+SEXP C_specstore_attach(std::string path);
+RcppExport SEXP _Rnmr1D_C_specstore_attach(SEXP pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_specstore_attach(path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_specstore_get
+SEXP C_specstore_get(SEXP p, int k, int i1, int i2);
+RcppExport SEXP _Rnmr1D_C_specstore_get(SEXP pSEXP, SEXP kSEXP, SEXP i1SEXP, SEXP i2SEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+    Rcpp::traits::input_parameter< int >::type k(kSEXP);
+    Rcpp::traits::input_parameter< int >::type i1(i1SEXP);
+    Rcpp::traits::input_parameter< int >::type i2(i2SEXP);
+    rcpp_result_gen = Rcpp::wrap(C_specstore_get(p, k, i1, i2));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_specstore_set
+void C_specstore_set(SEXP p, int k, int i1, NumericVector v);
+RcppExport SEXP _Rnmr1D_C_specstore_set(SEXP pSEXP, SEXP kSEXP, SEXP i1SEXP, SEXP vSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+    Rcpp::traits::input_parameter< int >::type k(kSEXP);
+    Rcpp::traits::input_parameter< int >::type i1(i1SEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type v(vSEXP);
+    C_specstore_set(p, k, i1, v);
+    return R_NilValue;
+END_RCPP
+}
+// C_specstore_matrix
+SEXP C_specstore_matrix(SEXP p, int j1, int j2);
+RcppExport SEXP _Rnmr1D_C_specstore_matrix(SEXP pSEXP, SEXP j1SEXP, SEXP j2SEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+    Rcpp::traits::input_parameter< int >::type j1(j1SEXP);
+    Rcpp::traits::input_parameter< int >::type j2(j2SEXP);
+    rcpp_result_gen = Rcpp::wrap(C_specstore_matrix(p, j1, j2));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_specstore_close
+void C_specstore_close(SEXP p, bool funlink);
+RcppExport SEXP _Rnmr1D_C_specstore_close(SEXP pSEXP, SEXP funlinkSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+    Rcpp::traits::input_parameter< bool >::type funlink(funlinkSEXP);
+    C_specstore_close(p, funlink);
+    return R_NilValue;
+END_RCPP
+}
+// C_estime_grpdelay
+double C_estime_grpdelay(ComplexVector fid);
+RcppExport SEXP _Rnmr1D_C_estime_grpdelay(SEXP fidSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< ComplexVector >::type fid(fidSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_estime_grpdelay(fid));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_grpdelay_fft
+SEXP C_grpdelay_fft(ComplexVector fid, double grpdly, int oc);
+RcppExport SEXP _Rnmr1D_C_grpdelay_fft(SEXP fidSEXP, SEXP grpdlySEXP, SEXP ocSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< ComplexVector >::type fid(fidSEXP);
+    Rcpp::traits::input_parameter< double >::type grpdly(grpdlySEXP);
+    Rcpp::traits::input_parameter< int >::type oc(ocSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_grpdelay_fft(fid, grpdly, oc));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_remove_lowfreq
+ComplexVector C_remove_lowfreq(ComplexVector fid, int np);
+RcppExport SEXP _Rnmr1D_C_remove_lowfreq(SEXP fidSEXP, SEXP npSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< ComplexVector >::type fid(fidSEXP);
+    Rcpp::traits::input_parameter< int >::type np(npSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_remove_lowfreq(fid, np));
+    return rcpp_result_gen;
+END_RCPP
+}
 // C_GlobSeg
 SEXP C_GlobSeg(SEXP v, int dN, double sig);
 RcppExport SEXP _Rnmr1D_C_GlobSeg(SEXP vSEXP, SEXP dNSEXP, SEXP sigSEXP) {
@@ -96,6 +331,30 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// C_Smooth_matrix
+SEXP C_Smooth_matrix(SEXP x, int n);
+RcppExport SEXP _Rnmr1D_C_Smooth_matrix(SEXP xSEXP, SEXP nSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< int >::type n(nSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_Smooth_matrix(x, n));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_lowpass1_matrix
+SEXP C_lowpass1_matrix(SEXP x, double alpha);
+RcppExport SEXP _Rnmr1D_C_lowpass1_matrix(SEXP xSEXP, SEXP alphaSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< double >::type alpha(alphaSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_lowpass1_matrix(x, alpha));
+    return rcpp_result_gen;
+END_RCPP
+}
 // fitLines
 void fitLines(SEXP s, SEXP b, int n1, int n2);
 RcppExport SEXP _Rnmr1D_fitLines(SEXP sSEXP, SEXP bSEXP, SEXP n1SEXP, SEXP n2SEXP) {
@@ -155,6 +414,20 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// C_noise_stats
+SEXP C_noise_stats(SEXP x, int n1, int n2, int flg);
+RcppExport SEXP _Rnmr1D_C_noise_stats(SEXP xSEXP, SEXP n1SEXP, SEXP n2SEXP, SEXP flgSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< int >::type n1(n1SEXP);
+    Rcpp::traits::input_parameter< int >::type n2(n2SEXP);
+    Rcpp::traits::input_parameter< int >::type flg(flgSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_noise_stats(x, n1, n2, flg));
+    return rcpp_result_gen;
+END_RCPP
+}
 // C_spec_ref_interval
 SEXP C_spec_ref_interval(SEXP x, int istart, int iend, IntegerVector v);
 RcppExport SEXP _Rnmr1D_C_spec_ref_interval(SEXP xSEXP, SEXP istartSEXP, SEXP iendSEXP, SEXP vSEXP) {
@@ -259,6 +532,39 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// C_ptw_warp
+SEXP C_ptw_warp(SEXP x, int istart, int iend, IntegerVector v, int idx_vref, int crit, int trwdth, int ncand, bool inplace);
+RcppExport SEXP _Rnmr1D_C_ptw_warp(SEXP xSEXP, SEXP istartSEXP, SEXP iendSEXP, SEXP vSEXP, SEXP idx_vrefSEXP, SEXP critSEXP, SEXP trwdthSEXP, SEXP ncandSEXP, SEXP inplaceSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< int >::type istart(istartSEXP);
+    Rcpp::traits::input_parameter< int >::type iend(iendSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type v(vSEXP);
+    Rcpp::traits::input_parameter< int >::type idx_vref(idx_vrefSEXP);
+    Rcpp::traits::input_parameter< int >::type crit(critSEXP);
+    Rcpp::traits::input_parameter< int >::type trwdth(trwdthSEXP);
+    Rcpp::traits::input_parameter< int >::type ncand(ncandSEXP);
+    Rcpp::traits::input_parameter< bool >::type inplace(inplaceSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_ptw_warp(x, istart, iend, v, idx_vref, crit, trwdth, ncand, inplace));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_ptw_bestref
+SEXP C_ptw_bestref(SEXP x, int crit, int trwdth, int ncand);
+RcppExport SEXP _Rnmr1D_C_ptw_bestref(SEXP xSEXP, SEXP critSEXP, SEXP trwdthSEXP, SEXP ncandSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< int >::type crit(critSEXP);
+    Rcpp::traits::input_parameter< int >::type trwdth(trwdthSEXP);
+    Rcpp::traits::input_parameter< int >::type ncand(ncandSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_ptw_bestref(x, crit, trwdth, ncand));
+    return rcpp_result_gen;
+END_RCPP
+}
 // C_noise_estimation
 double C_noise_estimation(SEXP x, int n1, int n2);
 RcppExport SEXP _Rnmr1D_C_noise_estimation(SEXP xSEXP, SEXP n1SEXP, SEXP n2SEXP) {
@@ -368,6 +674,21 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// C_buckets_snr_filter
+SEXP C_buckets_snr_filter(SEXP x, SEXP b, SEXP n, double snr, double prob);
+RcppExport SEXP _Rnmr1D_C_buckets_snr_filter(SEXP xSEXP, SEXP bSEXP, SEXP nSEXP, SEXP snrSEXP, SEXP probSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type b(bSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type n(nSEXP);
+    Rcpp::traits::input_parameter< double >::type snr(snrSEXP);
+    Rcpp::traits::input_parameter< double >::type prob(probSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_buckets_snr_filter(x, b, n, snr, prob));
+    return rcpp_result_gen;
+END_RCPP
+}
 // C_ppmIntMax_buckets
 SEXP C_ppmIntMax_buckets(SEXP x, SEXP b);
 RcppExport SEXP _Rnmr1D_C_ppmIntMax_buckets(SEXP xSEXP, SEXP bSEXP) {
@@ -391,6 +712,62 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// C_ppm_index
+SEXP C_ppm_index(SEXP p, SEXP v);
+RcppExport SEXP _Rnmr1D_C_ppm_index(SEXP pSEXP, SEXP vSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type v(vSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_ppm_index(p, v));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_buckets_dataset
+SEXP C_buckets_dataset(SEXP x, SEXP p, SEXP b, SEXP l);
+RcppExport SEXP _Rnmr1D_C_buckets_dataset(SEXP xSEXP, SEXP pSEXP, SEXP bSEXP, SEXP lSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type b(bSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type l(lSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_buckets_dataset(x, p, b, l));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_spectra_normalize
+SEXP C_spectra_normalize(SEXP x, SEXP z, int meth, SEXP r, bool inplace);
+RcppExport SEXP _Rnmr1D_C_spectra_normalize(SEXP xSEXP, SEXP zSEXP, SEXP methSEXP, SEXP rSEXP, SEXP inplaceSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type z(zSEXP);
+    Rcpp::traits::input_parameter< int >::type meth(methSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type r(rSEXP);
+    Rcpp::traits::input_parameter< bool >::type inplace(inplaceSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_spectra_normalize(x, z, meth, r, inplace));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_spectra_resample
+SEXP C_spectra_resample(SEXP l, SEXP pmin, SEXP dppm, SEXP ppm, int meth);
+RcppExport SEXP _Rnmr1D_C_spectra_resample(SEXP lSEXP, SEXP pminSEXP, SEXP dppmSEXP, SEXP ppmSEXP, SEXP methSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type l(lSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type pmin(pminSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type dppm(dppmSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type ppm(ppmSEXP);
+    Rcpp::traits::input_parameter< int >::type meth(methSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_spectra_resample(l, pmin, dppm, ppm, meth));
+    return rcpp_result_gen;
+END_RCPP
+}
 // C_estime_sd
 double C_estime_sd(SEXP x, int cut);
 RcppExport SEXP _Rnmr1D_C_estime_sd(SEXP xSEXP, SEXP cutSEXP) {
@@ -459,19 +836,220 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// C_corr_matrix
+SEXP C_corr_matrix(SEXP x, int rank);
+RcppExport SEXP _Rnmr1D_C_corr_matrix(SEXP xSEXP, SEXP rankSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< int >::type rank(rankSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_corr_matrix(x, rank));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_corr_cvals_stats
+SEXP C_corr_cvals_stats(SEXP c, NumericVector cvals);
+RcppExport SEXP _Rnmr1D_C_corr_cvals_stats(SEXP cSEXP, SEXP cvalsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type c(cSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type cvals(cvalsSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_corr_cvals_stats(c, cvals));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_corr_cvals_clusters
+SEXP C_corr_cvals_clusters(SEXP c, NumericVector cvals, int mincsize);
+RcppExport SEXP _Rnmr1D_C_corr_cvals_clusters(SEXP cSEXP, SEXP cvalsSEXP, SEXP mincsizeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type c(cSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type cvals(cvalsSEXP);
+    Rcpp::traits::input_parameter< int >::type mincsize(mincsizeSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_corr_cvals_clusters(c, cvals, mincsize));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_pipeline_run
+SEXP C_pipeline_run(SEXP x, SEXP l, bool inplace);
+RcppExport SEXP _Rnmr1D_C_pipeline_run(SEXP xSEXP, SEXP lSEXP, SEXP inplaceSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type l(lSEXP);
+    Rcpp::traits::input_parameter< bool >::type inplace(inplaceSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_pipeline_run(x, l, inplace));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_specstore_alloc
+SEXP C_specstore_alloc(std::string path, int nrow, int ncol);
+RcppExport SEXP _Rnmr1D_C_specstore_alloc(SEXP pathSEXP, SEXP nrowSEXP, SEXP ncolSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< int >::type nrow(nrowSEXP);
+    Rcpp::traits::input_parameter< int >::type ncol(ncolSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_specstore_alloc(path, nrow, ncol));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_specstore_rows
+SEXP C_specstore_rows(SEXP p, int k1, int k2);
+RcppExport SEXP _Rnmr1D_C_specstore_rows(SEXP pSEXP, SEXP k1SEXP, SEXP k2SEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+    Rcpp::traits::input_parameter< int >::type k1(k1SEXP);
+    Rcpp::traits::input_parameter< int >::type k2(k2SEXP);
+    rcpp_result_gen = Rcpp::wrap(C_specstore_rows(p, k1, k2));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_specstore_setrows
+void C_specstore_setrows(SEXP p, int k1, SEXP x);
+RcppExport SEXP _Rnmr1D_C_specstore_setrows(SEXP pSEXP, SEXP k1SEXP, SEXP xSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+    Rcpp::traits::input_parameter< int >::type k1(k1SEXP);
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    C_specstore_setrows(p, k1, x);
+    return R_NilValue;
+END_RCPP
+}
+// C_specstore_pipeline
+void C_specstore_pipeline(SEXP p, SEXP l, int nblock);
+RcppExport SEXP _Rnmr1D_C_specstore_pipeline(SEXP pSEXP, SEXP lSEXP, SEXP nblockSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type l(lSEXP);
+    Rcpp::traits::input_parameter< int >::type nblock(nblockSEXP);
+    C_specstore_pipeline(p, l, nblock);
+    return R_NilValue;
+END_RCPP
+}
+// C_specstore_stats
+SEXP C_specstore_stats(SEXP p, int n1, int n2, int flg, IntegerVector v, int nblock);
+RcppExport SEXP _Rnmr1D_C_specstore_stats(SEXP pSEXP, SEXP n1SEXP, SEXP n2SEXP, SEXP flgSEXP, SEXP vSEXP, SEXP nblockSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+    Rcpp::traits::input_parameter< int >::type n1(n1SEXP);
+    Rcpp::traits::input_parameter< int >::type n2(n2SEXP);
+    Rcpp::traits::input_parameter< int >::type flg(flgSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type v(vSEXP);
+    Rcpp::traits::input_parameter< int >::type nblock(nblockSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_specstore_stats(p, n1, n2, flg, v, nblock));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_specstore_normalize
+SEXP C_specstore_normalize(SEXP p, SEXP z, int meth, int nblock);
+RcppExport SEXP _Rnmr1D_C_specstore_normalize(SEXP pSEXP, SEXP zSEXP, SEXP methSEXP, SEXP nblockSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type z(zSEXP);
+    Rcpp::traits::input_parameter< int >::type meth(methSEXP);
+    Rcpp::traits::input_parameter< int >::type nblock(nblockSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_specstore_normalize(p, z, meth, nblock));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_specstore_snr_filter
+SEXP C_specstore_snr_filter(SEXP p, SEXP b, SEXP n, double snr, double prob, int nblock);
+RcppExport SEXP _Rnmr1D_C_specstore_snr_filter(SEXP pSEXP, SEXP bSEXP, SEXP nSEXP, SEXP snrSEXP, SEXP probSEXP, SEXP nblockSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type b(bSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type n(nSEXP);
+    Rcpp::traits::input_parameter< double >::type snr(snrSEXP);
+    Rcpp::traits::input_parameter< double >::type prob(probSEXP);
+    Rcpp::traits::input_parameter< int >::type nblock(nblockSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_specstore_snr_filter(p, b, n, snr, prob, nblock));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_specstore_buckets_dataset
+SEXP C_specstore_buckets_dataset(SEXP p, SEXP ppm, SEXP b, SEXP l, int nblock);
+RcppExport SEXP _Rnmr1D_C_specstore_buckets_dataset(SEXP pSEXP, SEXP ppmSEXP, SEXP bSEXP, SEXP lSEXP, SEXP nblockSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type ppm(ppmSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type b(bSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type l(lSEXP);
+    Rcpp::traits::input_parameter< int >::type nblock(nblockSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_specstore_buckets_dataset(p, ppm, b, l, nblock));
+    return rcpp_result_gen;
+END_RCPP
+}
+// C_synth_spectra
+SEXP C_synth_spectra(int nspec, int size, double density, double width, double shift, double noise, int seed);
+RcppExport SEXP _Rnmr1D_C_synth_spectra(SEXP nspecSEXP, SEXP sizeSEXP, SEXP densitySEXP, SEXP widthSEXP, SEXP shiftSEXP, SEXP noiseSEXP, SEXP seedSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< int >::type nspec(nspecSEXP);
+    Rcpp::traits::input_parameter< int >::type size(sizeSEXP);
+    Rcpp::traits::input_parameter< double >::type density(densitySEXP);
+    Rcpp::traits::input_parameter< double >::type width(widthSEXP);
+    Rcpp::traits::input_parameter< double >::type shift(shiftSEXP);
+    Rcpp::traits::input_parameter< double >::type noise(noiseSEXP);
+    Rcpp::traits::input_parameter< int >::type seed(seedSEXP);
+    rcpp_result_gen = Rcpp::wrap(C_synth_spectra(nspec, size, density, width, shift, noise, seed));
+    return rcpp_result_gen;
+END_RCPP
+}
 
 static const R_CallMethodDef CallEntries[] = {
     {"_Rnmr1D_SDL", (DL_FUNC) &_Rnmr1D_SDL, 2},
+    {"_Rnmr1D_C_get_nthreads", (DL_FUNC) &_Rnmr1D_C_get_nthreads, 0},
+    {"_Rnmr1D_C_set_nthreads", (DL_FUNC) &_Rnmr1D_C_set_nthreads, 1},
+    {"_Rnmr1D_C_perf_enable", (DL_FUNC) &_Rnmr1D_C_perf_enable, 1},
+    {"_Rnmr1D_C_perf_record", (DL_FUNC) &_Rnmr1D_C_perf_record, 5},
+    {"_Rnmr1D_C_perf_count", (DL_FUNC) &_Rnmr1D_C_perf_count, 2},
+    {"_Rnmr1D_C_perf_get", (DL_FUNC) &_Rnmr1D_C_perf_get, 0},
+    {"_Rnmr1D_C_perf_trace", (DL_FUNC) &_Rnmr1D_C_perf_trace, 0},
     {"_Rnmr1D_C_write_pack", (DL_FUNC) &_Rnmr1D_C_write_pack, 4},
     {"_Rnmr1D_C_read_pack", (DL_FUNC) &_Rnmr1D_C_read_pack, 1},
+    {"_Rnmr1D_C_hash_files", (DL_FUNC) &_Rnmr1D_C_hash_files, 2},
+    {"_Rnmr1D_C_read_jdf", (DL_FUNC) &_Rnmr1D_C_read_jdf, 1},
+    {"_Rnmr1D_C_read_nmrml", (DL_FUNC) &_Rnmr1D_C_read_nmrml, 1},
+    {"_Rnmr1D_C_find_rawfiles", (DL_FUNC) &_Rnmr1D_C_find_rawfiles, 4},
+    {"_Rnmr1D_C_specstore_create", (DL_FUNC) &_Rnmr1D_C_specstore_create, 2},
+    {"_Rnmr1D_C_specstore_attach", (DL_FUNC) &_Rnmr1D_C_specstore_attach, 1},
+    {"_Rnmr1D_C_specstore_get", (DL_FUNC) &_Rnmr1D_C_specstore_get, 4},
+    {"_Rnmr1D_C_specstore_set", (DL_FUNC) &_Rnmr1D_C_specstore_set, 4},
+    {"_Rnmr1D_C_specstore_matrix", (DL_FUNC) &_Rnmr1D_C_specstore_matrix, 3},
+    {"_Rnmr1D_C_specstore_close", (DL_FUNC) &_Rnmr1D_C_specstore_close, 2},
+    {"_Rnmr1D_C_estime_grpdelay", (DL_FUNC) &_Rnmr1D_C_estime_grpdelay, 1},
+    {"_Rnmr1D_C_grpdelay_fft", (DL_FUNC) &_Rnmr1D_C_grpdelay_fft, 3},
+    {"_Rnmr1D_C_remove_lowfreq", (DL_FUNC) &_Rnmr1D_C_remove_lowfreq, 2},
     {"_Rnmr1D_C_GlobSeg", (DL_FUNC) &_Rnmr1D_C_GlobSeg, 3},
     {"_Rnmr1D_lowpass1", (DL_FUNC) &_Rnmr1D_lowpass1, 2},
     {"_Rnmr1D_WinMoy", (DL_FUNC) &_Rnmr1D_WinMoy, 3},
     {"_Rnmr1D_Smooth", (DL_FUNC) &_Rnmr1D_Smooth, 2},
+    {"_Rnmr1D_C_Smooth_matrix", (DL_FUNC) &_Rnmr1D_C_Smooth_matrix, 2},
+    {"_Rnmr1D_C_lowpass1_matrix", (DL_FUNC) &_Rnmr1D_C_lowpass1_matrix, 2},
     {"_Rnmr1D_fitLines", (DL_FUNC) &_Rnmr1D_fitLines, 4},
     {"_Rnmr1D_C_Estime_LB", (DL_FUNC) &_Rnmr1D_C_Estime_LB, 6},
     {"_Rnmr1D_C_Estime_LB2", (DL_FUNC) &_Rnmr1D_C_Estime_LB2, 6},
     {"_Rnmr1D_C_noise_estimate", (DL_FUNC) &_Rnmr1D_C_noise_estimate, 4},
+    {"_Rnmr1D_C_noise_stats", (DL_FUNC) &_Rnmr1D_C_noise_stats, 4},
     {"_Rnmr1D_C_spec_ref_interval", (DL_FUNC) &_Rnmr1D_C_spec_ref_interval, 4},
     {"_Rnmr1D_C_spec_ref", (DL_FUNC) &_Rnmr1D_C_spec_ref, 2},
     {"_Rnmr1D_C_MedianSpec", (DL_FUNC) &_Rnmr1D_C_MedianSpec, 1},
@@ -480,6 +1058,8 @@ static const R_CallMethodDef CallEntries[] = {
     {"_Rnmr1D_C_Integre", (DL_FUNC) &_Rnmr1D_C_Integre, 3},
     {"_Rnmr1D_C_segment_shifts", (DL_FUNC) &_Rnmr1D_C_segment_shifts, 6},
     {"_Rnmr1D_C_align_segment", (DL_FUNC) &_Rnmr1D_C_align_segment, 6},
+    {"_Rnmr1D_C_ptw_warp", (DL_FUNC) &_Rnmr1D_C_ptw_warp, 9},
+    {"_Rnmr1D_C_ptw_bestref", (DL_FUNC) &_Rnmr1D_C_ptw_bestref, 4},
     {"_Rnmr1D_C_noise_estimation", (DL_FUNC) &_Rnmr1D_C_noise_estimation, 3},
     {"_Rnmr1D_C_aibin_buckets", (DL_FUNC) &_Rnmr1D_C_aibin_buckets, 6},
     {"_Rnmr1D_C_SDL_convolution", (DL_FUNC) &_Rnmr1D_C_SDL_convolution, 3},
@@ -488,13 +1068,31 @@ static const R_CallMethodDef CallEntries[] = {
     {"_Rnmr1D_C_buckets_integrate", (DL_FUNC) &_Rnmr1D_C_buckets_integrate, 3},
     {"_Rnmr1D_C_all_buckets_integrate", (DL_FUNC) &_Rnmr1D_C_all_buckets_integrate, 3},
     {"_Rnmr1D_C_maxval_buckets", (DL_FUNC) &_Rnmr1D_C_maxval_buckets, 2},
+    {"_Rnmr1D_C_buckets_snr_filter", (DL_FUNC) &_Rnmr1D_C_buckets_snr_filter, 5},
     {"_Rnmr1D_C_ppmIntMax_buckets", (DL_FUNC) &_Rnmr1D_C_ppmIntMax_buckets, 2},
     {"_Rnmr1D_C_buckets_CSN_normalize", (DL_FUNC) &_Rnmr1D_C_buckets_CSN_normalize, 1},
+    {"_Rnmr1D_C_ppm_index", (DL_FUNC) &_Rnmr1D_C_ppm_index, 2},
+    {"_Rnmr1D_C_buckets_dataset", (DL_FUNC) &_Rnmr1D_C_buckets_dataset, 4},
+    {"_Rnmr1D_C_spectra_normalize", (DL_FUNC) &_Rnmr1D_C_spectra_normalize, 5},
+    {"_Rnmr1D_C_spectra_resample", (DL_FUNC) &_Rnmr1D_C_spectra_resample, 5},
     {"_Rnmr1D_C_estime_sd", (DL_FUNC) &_Rnmr1D_C_estime_sd, 2},
     {"_Rnmr1D_ajustBL", (DL_FUNC) &_Rnmr1D_ajustBL, 2},
     {"_Rnmr1D_C_corr_spec_re", (DL_FUNC) &_Rnmr1D_C_corr_spec_re, 1},
     {"_Rnmr1D_Fmin", (DL_FUNC) &_Rnmr1D_Fmin, 6},
     {"_Rnmr1D_Fentropy", (DL_FUNC) &_Rnmr1D_Fentropy, 7},
+    {"_Rnmr1D_C_corr_matrix", (DL_FUNC) &_Rnmr1D_C_corr_matrix, 2},
+    {"_Rnmr1D_C_corr_cvals_stats", (DL_FUNC) &_Rnmr1D_C_corr_cvals_stats, 2},
+    {"_Rnmr1D_C_corr_cvals_clusters", (DL_FUNC) &_Rnmr1D_C_corr_cvals_clusters, 3},
+    {"_Rnmr1D_C_pipeline_run", (DL_FUNC) &_Rnmr1D_C_pipeline_run, 3},
+    {"_Rnmr1D_C_specstore_alloc", (DL_FUNC) &_Rnmr1D_C_specstore_alloc, 3},
+    {"_Rnmr1D_C_specstore_rows", (DL_FUNC) &_Rnmr1D_C_specstore_rows, 3},
+    {"_Rnmr1D_C_specstore_setrows", (DL_FUNC) &_Rnmr1D_C_specstore_setrows, 3},
+    {"_Rnmr1D_C_specstore_pipeline", (DL_FUNC) &_Rnmr1D_C_specstore_pipeline, 3},
+    {"_Rnmr1D_C_specstore_stats", (DL_FUNC) &_Rnmr1D_C_specstore_stats, 6},
+    {"_Rnmr1D_C_specstore_normalize", (DL_FUNC) &_Rnmr1D_C_specstore_normalize, 4},
+    {"_Rnmr1D_C_specstore_snr_filter", (DL_FUNC) &_Rnmr1D_C_specstore_snr_filter, 6},
+    {"_Rnmr1D_C_specstore_buckets_dataset", (DL_FUNC) &_Rnmr1D_C_specstore_buckets_dataset, 5},
+    {"_Rnmr1D_C_synth_spectra", (DL_FUNC) &_Rnmr1D_C_synth_spectra, 7},
     {NULL, NULL, 0}
 };
 
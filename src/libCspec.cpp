@@ -11,8 +11,35 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <random>
+#include <complex>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <deque>
+#include <thread>
+#include <dirent.h>
 #include <math.h>
 #include <float.h>
+#include <zlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "libStencil.h"
 
 // [[Rcpp::plugins(openmp)]]
 
@@ -70,13 +97,206 @@ SEXP SDL(SEXP x, double Sigma)
    NumericVector X(x);
    int N = X.size();
    NumericVector Out(N);
-   double v1, v2;
-   for(int n = 0; n<N; n++)
+   _sdl(X.begin(), N, Sigma, Out.begin());
+   return Out;
+}
+
+// ---------------------------------------------------
+//  Number of threads used by the native kernels : the OpenMP runtime keeps its team of
+//  threads alive between the parallel regions, so they are started once per session and
+//  shared by all the kernels below
+// ---------------------------------------------------
+
+// [[Rcpp::export]]
+int C_get_nthreads ()
+{
+#ifdef _OPENMP
+   return omp_get_max_threads();
+#else
+   return 1;
+#endif
+}
+
+// [[Rcpp::export]]
+int C_set_nthreads (int n)
+{
+   int prev = C_get_nthreads();
+#ifdef _OPENMP
+   if (n>0) omp_set_num_threads(n);
+#else
+   (void)n;
+#endif
+   return prev;
+}
+
+// ---------------------------------------------------
+//  Performance counters : the kernels record their wall / CPU time, the bytes processed and some
+//  counts (evaluations, buckets) within a registry holding one table per thread, so that no lock
+//  is taken on the hot path; the tables are merged when read. The times of nested scopes are
+//  inclusive. When disabled (mode 0), a scope only costs the test of a flag.
+// ---------------------------------------------------
+
+struct PerfStat {
+   double calls = 0, wall = 0, cpu = 0, bytes = 0, count = 0;
+};
+
+struct PerfEvent {
+   std::string name;
+   double ts, dur;      // start time since the epoch and duration, in microseconds
+};
+
+struct PerfThread {
+   int tid;
+   std::map<std::string, PerfStat> stats;
+   std::vector<PerfEvent> events;
+};
+
+// 0 : disabled, 1 : counters, 2 : counters + events of the trace
+static std::atomic<int> perf_mode(0);
+static std::mutex perf_mutex;
+static std::vector< std::unique_ptr<PerfThread> > perf_threads;
+static thread_local PerfThread *perf_local = nullptr;
+
+/* Table of the calling thread, registered at its first use (the tables are never freed, the
+   threads of the OpenMP team being persistent) */
+PerfThread *_perf_thread ()
+{
+   if (!perf_local) {
+      std::lock_guard<std::mutex> lock(perf_mutex);
+      perf_threads.emplace_back(new PerfThread());
+      perf_local = perf_threads.back().get();
+      perf_local->tid = (int)perf_threads.size() - 1;
+   }
+   return perf_local;
+}
+
+double _perf_walltime ()
+{
+   return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+double _perf_cputime ()
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID) && !defined(_WIN32)
+   struct timespec ts;
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+   return (double)ts.tv_sec + 1e-9*(double)ts.tv_nsec;
+#else
+   return (double)std::clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+void _perf_record (const char *name, double ts, double wall, double cpu, double bytes, double count, bool fevent=true)
+{
+   PerfThread *pt = _perf_thread();
+   PerfStat &s = pt->stats[name];
+   s.calls += 1; s.wall += wall; s.cpu += cpu; s.bytes += bytes; s.count += count;
+   if (fevent && perf_mode.load(std::memory_order_relaxed)==2)
+      pt->events.push_back(PerfEvent{ name, 1e6*ts, 1e6*wall });
+}
+
+/* Count only (no time), e.g. number of buckets found */
+void _perf_count (const char *name, double n)
+{
+   if (perf_mode.load(std::memory_order_relaxed)==0) return;
+   PerfThread *pt = _perf_thread();
+   PerfStat &s = pt->stats[name];
+   s.calls += 1; s.count += n;
+}
+
+/* Scoped timer : records the time elapsed between its construction and its destruction.
+   fevent=false for the scopes called too often to be traced (e.g. the objective functions) */
+class PerfScope {
+   const char *name;
+   double bytes, count, t0, c0;
+   bool fevent;
+public:
+   PerfScope (const char *name, double bytes=0, bool fevent=true)
+      : name(perf_mode.load(std::memory_order_relaxed) ? name : nullptr), bytes(bytes), count(0), t0(0), c0(0), fevent(fevent)
    {
-       v1 = X[n]*X[n]; v2 = Sigma*Sigma; 
-       Out[n] = (12.0*v1-v2)/pow(4.0*v1+v2, 3);
+      if (this->name) { t0 = _perf_walltime(); c0 = _perf_cputime(); }
    }
-   return Out;
+   void add (double n) { count += n; }
+   ~PerfScope ()
+   {
+      if (!name) return;
+      double t1 = _perf_walltime();
+      _perf_record(name, t0, t1-t0, _perf_cputime()-c0, bytes, count, fevent);
+   }
+};
+
+// C_perf_enable : set the mode of the performance counters (0 : disabled, 1 : counters, 2 : counters
+//   and trace events) and clear them. Must be called outside of any parallel region. Returns the previous mode.
+// [[Rcpp::export]]
+int C_perf_enable (int mode)
+{
+   std::lock_guard<std::mutex> lock(perf_mutex);
+   for (size_t t=0; t<perf_threads.size(); t++) {
+       perf_threads[t]->stats.clear();
+       perf_threads[t]->events.clear();
+   }
+   return perf_mode.exchange(mode);
+}
+
+// C_perf_record : record a stage of the R code (e.g. a macro-command) ending now, of duration wall seconds
+//   (cpu : its CPU time in seconds, NA if not measured)
+// [[Rcpp::export]]
+void C_perf_record (std::string name, double wall, double cpu, double bytes=0, double count=0)
+{
+   if (perf_mode.load()==0) return;
+   _perf_record(name.c_str(), _perf_walltime() - wall, wall, cpu, bytes, count);
+}
+
+// C_perf_count : add n to the counter 'name'
+// [[Rcpp::export]]
+void C_perf_count (std::string name, double n)
+{
+   _perf_count(name.c_str(), n);
+}
+
+// C_perf_get : counters merged over the threads, 1 row per stage (wall and cpu in seconds)
+// [[Rcpp::export]]
+SEXP C_perf_get ()
+{
+   std::map<std::string, PerfStat> M;
+   {
+      std::lock_guard<std::mutex> lock(perf_mutex);
+      for (size_t t=0; t<perf_threads.size(); t++)
+          for (auto &it : perf_threads[t]->stats) {
+              PerfStat &s = M[it.first];
+              s.calls += it.second.calls; s.wall += it.second.wall; s.cpu += it.second.cpu;
+              s.bytes += it.second.bytes; s.count += it.second.count;
+          }
+   }
+   int n = (int)M.size(), k = 0;
+   CharacterVector stage(n);
+   NumericVector calls(n), wall(n), cpu(n), bytes(n), count(n);
+   for (auto &it : M) {
+       stage[k] = it.first; calls[k] = it.second.calls; wall[k] = it.second.wall;
+       cpu[k] = it.second.cpu; bytes[k] = it.second.bytes; count[k] = it.second.count;
+       k++;
+   }
+   return DataFrame::create( _["stage"] = stage, _["calls"] = calls, _["wall"] = wall, _["cpu"] = cpu,
+                             _["bytes"] = bytes, _["count"] = count, _["stringsAsFactors"] = false );
+}
+
+// C_perf_trace : events recorded in mode 2 (ts = start since the epoch, dur = duration, in microseconds)
+// [[Rcpp::export]]
+SEXP C_perf_trace ()
+{
+   std::lock_guard<std::mutex> lock(perf_mutex);
+   size_t n = 0, k = 0;
+   for (size_t t=0; t<perf_threads.size(); t++) n += perf_threads[t]->events.size();
+   CharacterVector name(n);
+   IntegerVector tid(n);
+   NumericVector ts(n), dur(n);
+   for (size_t t=0; t<perf_threads.size(); t++)
+       for (auto &e : perf_threads[t]->events) {
+           name[k] = e.name; tid[k] = perf_threads[t]->tid; ts[k] = e.ts; dur[k] = e.dur;
+           k++;
+       }
+   return DataFrame::create( _["name"] = name, _["tid"] = tid, _["ts"] = ts, _["dur"] = dur,
+                             _["stringsAsFactors"] = false );
 }
 
 // ---------------------------------------------------
@@ -88,6 +308,7 @@ void C_write_pack (SEXP x, double pmin, double pmax, SEXP ff)
 {
    // Matrix of spectra : 1 row = 1 spectrum, 1 column = a same value of ppm
    NumericMatrix xx(x);
+   PerfScope perf("C_write_pack", 8.0*xx.nrow()*xx.ncol());
 
    std::string fname = as<std::string>(ff); 
 
@@ -117,6 +338,11 @@ void C_write_pack (SEXP x, double pmin, double pmax, SEXP ff)
 
    outBinFile.flush();
    outBinFile.close(); 
+   delete[] buf;
+   delete inforec;
+
+   // a partial file (e.g. disk full) must not be taken as a valid pack
+   if (outBinFile.fail()) stop("Cannot write the file %s", fname);
 }
 
 // [[Rcpp::export]]
@@ -138,6 +364,7 @@ SEXP C_read_pack (SEXP ff)
    double pmin = inforec->pmin;
    int ncol = (unsigned)(inforec->size_l);
    int nrow = (unsigned)(inforec->size_c)-2;
+   PerfScope perf("C_read_pack", 8.0*nrow*ncol);
 
    // Matrix of spectra : 1 row = 1 spectrum, 1 column = a same value of ppm
    NumericMatrix M(nrow, ncol);
@@ -163,17 +390,1074 @@ SEXP C_read_pack (SEXP ff)
 }
 
 // ---------------------------------------------------
-//  Baseline Correction Routines
+//  Content hash of the raw data files (key of the cache of the processed spectra)
 // ---------------------------------------------------
 
+/* 64-bit hash mixing (finalizer of splitmix64) */
+static inline uint64_t _hash_mix(uint64_t h)
+{
+   h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+   h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+   h ^= h >> 31;
+   return h;
+}
+
+/* Hash update with a block of bytes, processed by words of 8 bytes */
+uint64_t _hash_bytes(uint64_t h, const unsigned char *p, size_t n)
+{
+   size_t i=0;
+   for (; i+8<=n; i+=8) {
+       uint64_t w;
+       memcpy(&w, p+i, 8);
+       h = _hash_mix(h ^ w) + 0x9e3779b97f4a7c15ULL;
+   }
+   uint64_t w=0;
+   for (size_t j=0; i<n; i++, j++) w |= (uint64_t)p[i] << (8*j);
+   return _hash_mix(h ^ w ^ ((uint64_t)n << 56));
+}
+
+// C_hash_files : hash of the content of the files then of the character string s, returned as
+//   an hexadecimal string; an empty string is returned if a file cannot be read
 // [[Rcpp::export]]
-SEXP C_GlobSeg (SEXP v, int dN, double sig)
+std::string C_hash_files (CharacterVector files, std::string s)
+{
+   uint64_t h = 0x84222325cbf29ce4ULL;
+   std::vector<unsigned char> buf(1<<20);
+   for (int f=0; f<files.size(); f++) {
+       std::string fname = as<std::string>(files[f]);
+       FILE *fp = fopen(fname.c_str(), "rb");
+       if (fp==NULL) return std::string("");
+       size_t n;
+       while ((n=fread(buf.data(), 1, buf.size(), fp))>0)
+           h = _hash_bytes(h, buf.data(), n);
+       fclose(fp);
+       h = _hash_mix(h ^ (uint64_t)(f+1));   // file separator
+   }
+   h = _hash_bytes(h, (const unsigned char *)s.c_str(), s.size());
+   char hex[17];
+   snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+   return std::string(hex);
+}
+
+// ---------------------------------------------------
+//  JEOL JDF files : the file is mapped in memory (read into a buffer on Windows), then the header,
+//  the parameters and the data section are decoded in a single pass without any R API, so that
+//  a list of files can be read in parallel.
+// ---------------------------------------------------
+
+static const char *jdf_unit_labels[] = {
+   "","Abundance","Ampere","Candela","dC","Coulomb","deg","Electronvolt","Farad","Sievert","Gram","Gray ","Henry","Hz","Kelvin",
+   "Joule","Liter","Lumen","Lux","Meter","Mole","Newton","Ohm","Pascal","Percent","Point","ppm","Radian","s","Siemens","Steradian",
+   "T","Volt","Watt","Weber","dB","Dalton","Thompson","Ugeneric","LPercent","PPT","PPB","Index"
+};
+static const char *jdf_unit_prefix[] = { "Yotta","Zetta","Exa","Pecta","Tera","G","M","k","","m","u","n","p","Femto","Atto","Zepto" };
+static const char *jdf_value_type[] = { "string", "integer", "float", "complex", "infinity" };
+
+struct JdfParam {
+   std::string name, unit, svalue;
+   int type, scaler;
+   double re, im;
+};
+
+struct JdfFile {
+   std::string error;
+   std::string identifier, title;
+   int endian, data_type;
+   int units[16];
+   int points[8], offset_start[8], offset_stop[8];
+   double base_freq[8];
+   std::vector<JdfParam> params;
+   std::vector<double> re, im;
+};
+
+/* Read-only view of a whole file */
+class MappedFile {
+public:
+    const unsigned char *data;
+    size_t size;
+
+    MappedFile(const std::string &fname) : data(NULL), size(0)
+    {
+#ifndef _WIN32
+       int fd = open(fname.c_str(), O_RDONLY);
+       if (fd<0) return;
+       struct stat sb;
+       if (fstat(fd, &sb)==0 && sb.st_size>0) {
+          void *p = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+          if (p!=MAP_FAILED) { data = (const unsigned char *)p; size = (size_t)sb.st_size; }
+       }
+       close(fd);
+#else
+       FILE *fp = fopen(fname.c_str(), "rb");
+       if (fp==NULL) return;
+       _fseeki64(fp, 0, SEEK_END);
+       int64_t n = _ftelli64(fp);
+       _fseeki64(fp, 0, SEEK_SET);
+       if (n>0) {
+          buf.resize((size_t)n);
+          if (fread(buf.data(), 1, (size_t)n, fp)==(size_t)n) { data = buf.data(); size = (size_t)n; }
+       }
+       fclose(fp);
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifndef _WIN32
+       if (data) munmap((void *)data, size);
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    std::vector<unsigned char> buf;
+#endif
+};
+
+/* Value of type T at p, stored with the given byte order */
+template <typename T> T _jdf_get (const unsigned char *p, bool big)
+{
+   static const uint16_t one = 1;
+   unsigned char b[sizeof(T)];
+   memcpy(b, p, sizeof(T));
+   if (big == (*(const unsigned char *)&one == 1)) std::reverse(b, b+sizeof(T));
+   T v;
+   memcpy(&v, b, sizeof(T));
+   return v;
+}
+
+/* Character field of n bytes (up to the first null character) */
+std::string _jdf_string (const unsigned char *p, size_t n)
+{
+   size_t len = 0;
+   while (len<n && p[len]!=0) len++;
+   return std::string((const char *)p, len);
+}
+
+std::string _jdf_trim (const std::string &s)
+{
+   size_t i1 = s.find_first_not_of(" \t\r\n");
+   if (i1==std::string::npos) return std::string("");
+   size_t i2 = s.find_last_not_of(" \t\r\n");
+   return s.substr(i1, i2-i1+1);
+}
+
+void _jdf_parse (const std::string &fname, JdfFile &J)
+{
+   MappedFile F(fname);
+   const unsigned char *p = F.data;
+   if (p==NULL || F.size<1344) { J.error = "cannot read the file"; return; }
+
+   // Header (always big-endian)
+   J.identifier = _jdf_string(p, 8);
+   J.endian = p[8];
+   J.data_type = p[14];
+   for (int k=0; k<16; k++) J.units[k] = p[32+k];
+   J.title = _jdf_string(p+48, 124);
+   for (int k=0; k<8; k++) {
+       J.points[k] = _jdf_get<int32_t>(p+176+4*k, true);
+       J.offset_start[k] = _jdf_get<int32_t>(p+208+4*k, true);
+       J.offset_stop[k] = _jdf_get<int32_t>(p+240+4*k, true);
+       J.base_freq[k] = _jdf_get<double>(p+1064+8*k, true);
+   }
+   size_t param_start = (size_t)_jdf_get<int32_t>(p+1212, true);
+   size_t data_start = (size_t)_jdf_get<int32_t>(p+1284, true);
+   bool big = J.endian==0;
+
+   // Parameters : a header of 16 bytes then records of 64 bytes
+   if (param_start+16>F.size) { J.error = "truncated parameter section"; return; }
+   int nparams = _jdf_get<int32_t>(p+param_start+8, big) + 1;
+   const unsigned char *q = p + param_start + 16;
+   for (int i=0; i<nparams; i++, q+=64) {
+       if ((size_t)(q+64-p)>F.size) { J.error = "truncated parameter section"; return; }
+       JdfParam P;
+       P.scaler = _jdf_get<int16_t>(q+4, big);
+       P.type = _jdf_get<int32_t>(q+32, big);
+       P.re = P.im = NA_REAL;
+       switch (P.type) {
+           case 0: {
+               std::string v = _jdf_string(q+16, 16);
+               size_t pos;
+               while ((pos=v.find('\\'))!=std::string::npos) v[pos] = '/';
+               while ((pos=v.find("<<"))!=std::string::npos) v.erase(pos, 2);
+               P.svalue = _jdf_trim(v);
+               break;
+           }
+           case 1: case 4: P.re = _jdf_get<int32_t>(q+16, big); break;
+           case 2: P.re = _jdf_get<double>(q+16, big); break;
+           case 3: P.re = _jdf_get<double>(q+16, big); P.im = _jdf_get<double>(q+24, big); break;
+       }
+       std::string name = _jdf_trim(_jdf_string(q+36, 28));
+       for (size_t c=0; c<name.size(); c++) {
+           name[c] = (char)tolower((unsigned char)name[c]);
+           if (name[c]==' ' || name[c]=='.') name[c] = '_';
+       }
+       P.name = name;
+       // Unit : prefix (high nibble of the 1st byte) + label (2nd byte)
+       int u1 = q[6], u2 = q[7];
+       std::string prefix("");
+       if (u1>0) { int v1 = u1/16; prefix = jdf_unit_prefix[ v1<8 ? v1+8 : v1-8 ]; }
+       P.unit = prefix + (u2<43 ? jdf_unit_labels[u2] : "");
+       J.params.push_back(P);
+   }
+
+   // FID data : real part then imaginary part, as 64-bit (One_D) or 32-bit floats
+   int fmt = J.data_type & 0x3F, prec = J.data_type >> 6;
+   if (fmt!=1 || prec>1) return;
+   size_t wsize = prec==0 ? 8 : 4;
+   size_t off = (size_t)J.offset_start[0];
+   size_t npts = (size_t)(J.offset_stop[0]-J.offset_start[0]+1);
+   size_t pos_re = data_start + off, pos_im = pos_re + npts*wsize + off;
+   if (J.offset_stop[0]<J.offset_start[0] || pos_im + npts*wsize > F.size) { J.error = "truncated data section"; return; }
+   J.re.resize(npts); J.im.resize(npts);
+   for (size_t i=0; i<npts; i++) {
+       if (wsize==8) {
+           J.re[i] = _jdf_get<double>(p+pos_re+8*i, big);
+           J.im[i] = _jdf_get<double>(p+pos_im+8*i, big);
+       } else {
+           J.re[i] = _jdf_get<float>(p+pos_re+4*i, big);
+           J.im[i] = _jdf_get<float>(p+pos_im+4*i, big);
+       }
+   }
+}
+
+// C_read_jdf : read the JEOL JDF files, in parallel. Returns for each file a list (header, params, fid, error) :
+//   params is the named list of the parameters, each one being a list (value_type, value, Unit, Unit_Scaler),
+//   fid the complex FID (NULL if the data are not 1D), error an empty string if the file was correctly read.
+// [[Rcpp::export]]
+SEXP C_read_jdf (CharacterVector files)
+{
+   int nfiles = files.size();
+   std::vector<std::string> fnames(nfiles);
+   for (int f=0; f<nfiles; f++) fnames[f] = as<std::string>(files[f]);
+   std::vector<JdfFile> JL(nfiles);
+   PerfScope perf("C_read_jdf");
+
+   int f;
+   #pragma omp parallel for schedule(dynamic,1)
+   for (f=0; f<nfiles; f++) _jdf_parse(fnames[f], JL[f]);
+
+   List out(nfiles);
+   for (f=0; f<nfiles; f++) {
+       JdfFile &J = JL[f];
+       perf.add(J.re.size());
+       CharacterVector axis_units(8);
+       for (int k=0; k<8; k++) axis_units[k] = J.units[2*k+1]<43 ? jdf_unit_labels[J.units[2*k+1]] : "";
+       List header = List::create( _["File_Identifier"] = J.identifier, _["Endian"] = J.endian, _["Data_Type"] = J.data_type,
+                                   _["Title"] = J.title, _["Axis_Units"] = axis_units,
+                                   _["Data_Points"] = IntegerVector(J.points, J.points+8),
+                                   _["Data_Offset_Start"] = IntegerVector(J.offset_start, J.offset_start+8),
+                                   _["Data_Offset_Stop"] = IntegerVector(J.offset_stop, J.offset_stop+8),
+                                   _["Base_Freq"] = NumericVector(J.base_freq, J.base_freq+8) );
+       // Parameters : the last occurrence of a name is kept
+       std::map<std::string, size_t> last;
+       for (size_t i=0; i<J.params.size(); i++) last[J.params[i].name] = i;
+       List params(last.size());
+       CharacterVector pnames(last.size());
+       int n = 0;
+       for (size_t i=0; i<J.params.size(); i++) {
+           JdfParam &P = J.params[i];
+           if (last[P.name]!=i) continue;
+           SEXP value;
+           if (P.type==0) {
+               value = wrap(P.svalue);
+           } else if (P.type==3) {
+               ComplexVector c(1); c[0].r = P.re; c[0].i = P.im;
+               value = c;
+           } else {
+               value = wrap(P.re);
+           }
+           params[n] = List::create( _["value_type"] = (P.type>=0 && P.type<5) ? jdf_value_type[P.type] : "NA", _["value"] = value,
+                                     _["Unit"] = P.unit, _["Unit_Scaler"] = P.scaler );
+           pnames[n] = P.name;
+           n++;
+       }
+       params.names() = pnames;
+       SEXP fid = R_NilValue;
+       if (J.re.size()>0) {
+           ComplexVector z(J.re.size());
+           for (size_t i=0; i<J.re.size(); i++) { z[i].r = J.re[i]; z[i].i = J.im[i]; }
+           fid = z;
+       }
+       out[f] = List::create( _["header"] = header, _["params"] = params, _["fid"] = fid, _["error"] = J.error );
+   }
+   return out;
+}
+
+// ---------------------------------------------------
+//  nmrML files : the XML is scanned once by chunks (no tree is built), the base64 content of the
+//  fidData element being decoded on the fly into a zlib inflate stream whose output is converted
+//  straight into the points of the FID, so that the memory used does not depend on the file size
+//  beyond the FID itself.
+// ---------------------------------------------------
+
+struct NmrmlData {
+   std::string error;
+   std::map<std::string, std::string> values;   // tag -> attribute of its first occurrence
+   std::string instrument, probe, id;
+   std::string byte_format;
+   bool compressed;
+   std::vector<double> signal;                  // (re, im) interleaved
+};
+
+/* Decoder of the binary content of the FID : base64 -> (inflate) -> values of the given format.
+   The byteFormat follows the nmrML schema : Complex64 is a pair of float32 (and Complex128 a pair of
+   float64, the default), whereas the previous R reader always read float64 values whatever the
+   byteFormat. */
+class NmrmlFidDecoder {
+public:
+    NmrmlFidDecoder(NmrmlData &D) : D(D), nbits(0), acc(0), ok(true), zinit(false), zend(false)
+    {
+       const std::string &f = D.byte_format;
+       wsize = 8; wtype = 0;
+       if (f=="float32" || f=="Complex64") { wsize = 4; wtype = 1; }
+       if (f=="int32" || f=="Integer32") { wsize = 4; wtype = 2; }
+       if (D.compressed) {
+          memset(&zs, 0, sizeof(zs));
+          ok = zinit = inflateInit2(&zs, 15+32)==Z_OK;    // zlib or gzip header
+          if (!ok) D.error = "cannot initialize the zlib stream";
+       }
+    }
+
+    ~NmrmlFidDecoder() { if (zinit) inflateEnd(&zs); }
+
+    void feed (const char *p, size_t n)
+    {
+       unsigned char out[4096];
+       size_t m = 0;
+       for (size_t i=0; i<n && ok; i++) {
+           int v = _b64(p[i]);
+           if (v<0) continue;                        // white spaces, padding
+           acc = (acc<<6) | (unsigned)v; nbits += 6;
+           if (nbits>=8) { nbits -= 8; out[m++] = (unsigned char)(acc >> nbits); acc &= (1u<<nbits)-1; }
+           if (m==sizeof(out)) { _bytes(out, m); m = 0; }
+       }
+       if (m>0 && ok) _bytes(out, m);
+    }
+
+    /* End of the fidData element : the compressed stream must be complete and the values must form
+       whole (re, im) pairs */
+    void finish ()
+    {
+       if (!ok) return;
+       if (D.compressed && !zend)      D.error = "truncated compressed data";
+       else if (!word.empty())         D.error = "trailing bytes not forming a whole value";
+       else if (D.signal.size() % 2)   D.error = "odd number of values (re, im)";
+       ok = D.error.empty();
+    }
+
+private:
+    NmrmlData &D;
+    int nbits;
+    unsigned acc;
+    bool ok, zinit, zend;
+    z_stream zs;
+    size_t wsize;
+    int wtype;
+    std::vector<unsigned char> word;
+
+    static int _b64 (char c)
+    {
+       if (c>='A' && c<='Z') return c-'A';
+       if (c>='a' && c<='z') return c-'a'+26;
+       if (c>='0' && c<='9') return c-'0'+52;
+       if (c=='+') return 62;
+       if (c=='/') return 63;
+       return -1;
+    }
+
+    void _bytes (const unsigned char *p, size_t n)
+    {
+       if (!D.compressed) { _values(p, n); return; }
+       if (zend) return;                             // data after the end of the stream are ignored
+       unsigned char out[16384];
+       zs.next_in = (Bytef *)p; zs.avail_in = (uInt)n;
+       // the output buffer may be filled before the input is used up : go on as long as it is full
+       while ((zs.avail_in>0 || zs.avail_out==0) && ok) {
+           zs.next_out = out; zs.avail_out = sizeof(out);
+           int ret = inflate(&zs, Z_NO_FLUSH);
+           if (ret==Z_BUF_ERROR) break;              // no progress possible, more input needed
+           if (ret!=Z_OK && ret!=Z_STREAM_END) { D.error = "corrupted compressed data"; ok = false; break; }
+           _values(out, sizeof(out)-zs.avail_out);
+           if (ret==Z_STREAM_END) { zend = true; break; }
+       }
+    }
+
+    /* Little-endian values, a value possibly straddling two blocks */
+    void _values (const unsigned char *p, size_t n)
+    {
+       for (size_t i=0; i<n; i++) {
+           word.push_back(p[i]);
+           if (word.size()<wsize) continue;
+           double v;
+           if (wtype==0)      v = _jdf_get<double>(word.data(), false);
+           else if (wtype==1) v = _jdf_get<float>(word.data(), false);
+           else               v = _jdf_get<int32_t>(word.data(), false);
+           D.signal.push_back(v);
+           word.clear();
+       }
+    }
+};
+
+/* Replace the predefined XML entities */
+std::string _xml_unescape (const std::string &s)
+{
+   static const char *ent[][2] = { {"&lt;","<"}, {"&gt;",">"}, {"&quot;","\""}, {"&apos;","'"}, {"&amp;","&"} };
+   std::string r = s;
+   for (int e=0; e<5; e++) {
+       size_t pos = 0, len = strlen(ent[e][0]);
+       while ((pos=r.find(ent[e][0], pos))!=std::string::npos) { r.replace(pos, len, ent[e][1]); pos++; }
+   }
+   return r;
+}
+
+/* Start tag : local name (without the namespace prefix) and attributes */
+void _xml_tag (const std::string &tag, std::string &name, std::map<std::string, std::string> &attrs)
+{
+   size_t i = 0, n = tag.size();
+   while (i<n && !isspace((unsigned char)tag[i]) && tag[i]!='/') i++;
+   name = tag.substr(0, i);
+   size_t c = name.find(':');
+   if (c!=std::string::npos) name = name.substr(c+1);
+   attrs.clear();
+   while (i<n) {
+       while (i<n && (isspace((unsigned char)tag[i]) || tag[i]=='/')) i++;
+       size_t k = i;
+       while (i<n && tag[i]!='=' && !isspace((unsigned char)tag[i])) i++;
+       std::string key = tag.substr(k, i-k);
+       while (i<n && tag[i]!='"' && tag[i]!='\'') i++;
+       if (i>=n) break;
+       char q = tag[i++];
+       k = i;
+       while (i<n && tag[i]!=q) i++;
+       attrs[key] = _xml_unescape(tag.substr(k, i-k));
+       i++;
+   }
+}
+
+void _nmrml_parse (const std::string &fname, NmrmlData &D)
+{
+   // Attribute of the first occurrence of each tag of interest
+   static const char *params[][2] = {
+      {"irradiationFrequency","value"}, {"irradiationFrequencyOffset","value"}, {"sweepWidth","value"},
+      {"DirectDimensionParameterSet","numberOfDataPoints"}, {"sampleAcquisitionTemperature","value"},
+      {"relaxationDelay","value"}, {"spinningRate","value"}, {"pulseWidth","value"}, {"groupDelay","value"},
+      {"acquisitionNucleus","name"}, {"acquisition1D","id"}
+   };
+   FILE *fp = fopen(fname.c_str(), "rb");
+   if (fp==NULL) { D.error = "cannot read the file"; return; }
+
+   std::vector<char> buf(1<<20);
+   std::vector<std::string> path;
+   std::string tag, name;
+   std::map<std::string, std::string> attrs;
+   std::unique_ptr<NmrmlFidDecoder> dec;
+   int fid_depth = -1, instr_depth = -1;
+   bool intag = false, fidDone = false;
+   char quote = 0;
+   size_t n;
+   while ((n=fread(buf.data(), 1, buf.size(), fp))>0 && D.error.empty()) {
+       size_t t0 = 0;                                // start of the current text run
+       for (size_t i=0; i<n; i++) {
+           char c = buf[i];
+           if (!intag) {
+               if (c!='<') continue;
+               if (dec && i>t0) dec->feed(&buf[t0], i-t0);
+               intag = true; tag.clear(); quote = 0;
+               continue;
+           }
+           if (quote) { if (c==quote) quote = 0; tag += c; continue; }
+           bool comment = tag.compare(0, 3, "!--")==0;
+           if (!comment && (c=='"' || c=='\'')) { quote = c; tag += c; continue; }
+           if (c!='>' || (comment && (tag.size()<5 || tag.compare(tag.size()-2, 2, "--")!=0))) { tag += c; continue; }
+           // end of a tag
+           intag = false; t0 = i+1;
+           if (tag.empty() || tag[0]=='?' || tag[0]=='!') continue;
+           if (tag[0]=='/') {
+               if (!path.empty()) path.pop_back();
+               if ((int)path.size()==fid_depth) { dec->finish(); dec.reset(); fid_depth = -1; fidDone = true; }
+               if ((int)path.size()==instr_depth) instr_depth = -2;
+               continue;
+           }
+           bool empty = tag[tag.size()-1]=='/';
+           _xml_tag(tag, name, attrs);
+           for (size_t k=0; k<sizeof(params)/sizeof(params[0]); k++)
+               if (name==params[k][0] && !D.values.count(name) && attrs.count(params[k][1]))
+                   D.values[name] = attrs[params[k][1]];
+           if (name=="instrumentConfiguration" && instr_depth==-1) instr_depth = (int)path.size();
+           if (instr_depth>=0 && (int)path.size()==instr_depth+1) {
+               if (name=="cvParam" && D.instrument.empty()) D.instrument = attrs["name"];
+               if (name=="userParam" && D.probe.empty()) D.probe = attrs["value"];
+           }
+           if (name=="fidData" && !fidDone && !empty && !path.empty() && path.back()=="acquisition1D") {
+               D.byte_format = attrs["byteFormat"];
+               D.compressed = attrs.count("compressed")==0 || attrs["compressed"]!="false";
+               size_t npts = (size_t)atol(D.values["DirectDimensionParameterSet"].c_str());
+               if (npts>0) D.signal.reserve(2*npts);
+               dec.reset(new NmrmlFidDecoder(D));
+               fid_depth = (int)path.size();
+           }
+           if (!empty) path.push_back(name);
+       }
+       if (dec && !intag && n>t0) dec->feed(&buf[t0], n-t0);
+   }
+   fclose(fp);
+   if (D.error.empty() && !fidDone) D.error = "no fidData element within acquisition1D";
+}
+
+// C_read_nmrml : read a nmrML file. Returns a list of the acquisition parameters (as character strings,
+//   empty if absent), of the complex FID (fid) and of an error message (empty if the file was correctly read)
+// [[Rcpp::export]]
+SEXP C_read_nmrml (std::string fname)
+{
+   NmrmlData D;
+   PerfScope perf("C_read_nmrml");
+   _nmrml_parse(fname, D);
+   size_t td = D.signal.size()/2;
+   perf.add(td);
+   ComplexVector fid(td);
+   for (size_t i=0; i<td; i++) { fid[i].r = D.signal[2*i]; fid[i].i = D.signal[2*i+1]; }
+   std::map<std::string, std::string> &V = D.values;
+   return List::create( _["SFO1"] = V["irradiationFrequency"], _["O1"] = V["irradiationFrequencyOffset"],
+                        _["SWH"] = V["sweepWidth"], _["TD"] = V["DirectDimensionParameterSet"],
+                        _["TEMP"] = V["sampleAcquisitionTemperature"], _["RELAXDELAY"] = V["relaxationDelay"],
+                        _["SPINNINGRATE"] = V["spinningRate"], _["PULSEWIDTH"] = V["pulseWidth"], _["GRPDLY"] = V["groupDelay"],
+                        _["NUC_LABEL"] = V["acquisitionNucleus"], _["ID"] = V["acquisition1D"],
+                        _["INSTRUMENT"] = D.instrument, _["PROBE"] = D.probe, _["fid"] = fid, _["error"] = D.error );
+}
+
+// ---------------------------------------------------
+//  Discovery of the raw spectra : the tree of the raw data is walked by all the threads in a single
+//  pass (one shared queue of directories), the sub-trees that cannot hold any other raw spectrum
+//  being pruned. The nucleus and the pulse program of the Bruker experiments are read on the way.
+// ---------------------------------------------------
+
+struct WalkDir {
+   std::string path;
+   int acq;             // index of the acqus fields of the enclosing Bruker experiment, -1 if none
+};
+
+struct WalkFile {
+   std::string path;
+   int acq;
+};
+
+/* Fields NUC1 and PULPROG of an acqus file */
+void _read_acqus (const std::string &fname, std::string &nuc, std::string &pulprog)
+{
+   FILE *fp = fopen(fname.c_str(), "r");
+   if (fp==NULL) return;
+   char line[1024];
+   while (fgets(line, sizeof(line), fp)) {
+       std::string *v = NULL;
+       const char *p = NULL;
+       if (strncmp(line, "##$NUC1=", 8)==0) { v = &nuc; p = line+8; }
+       if (strncmp(line, "##$PULPROG=", 11)==0) { v = &pulprog; p = line+11; }
+       if (v==NULL) continue;
+       std::string s = _jdf_trim(std::string(p));
+       if (s.size()>=2 && s[0]=='<' && s[s.size()-1]=='>') s = s.substr(1, s.size()-2);
+       *v = s;
+   }
+   fclose(fp);
+}
+
+bool _is_dir (const std::string &path)
+{
+   struct stat sb;
+   return stat(path.c_str(), &sb)==0 && S_ISDIR(sb.st_mode);
+}
+
+bool _has_suffix (const std::string &s, const std::vector<std::string> &suffixes)
+{
+   for (size_t k=0; k<suffixes.size(); k++) {
+       const std::string &x = suffixes[k];
+       if (s.size()>=x.size() && s.compare(s.size()-x.size(), x.size(), x)==0) return true;
+   }
+   return false;
+}
+
+// C_find_rawfiles : files under root whose name ends with one of the suffixes (hidden files and directories
+//   being skipped, as list.files does). If leaf is true, the sub-directories of a directory holding such
+//   a file are not walked. If subdir is not empty, only this sub-directory of a Bruker experiment directory
+//   (holding an acqus file) is walked. Returns the files (unsorted) with the fields NUC1 and PULPROG of the
+//   acqus file of their Bruker experiment (empty if none).
+// [[Rcpp::export]]
+SEXP C_find_rawfiles (std::string root, CharacterVector suffixes, bool leaf=false, std::string subdir="")
+{
+   std::vector<std::string> sfx(suffixes.size());
+   for (int k=0; k<suffixes.size(); k++) sfx[k] = as<std::string>(suffixes[k]);
+   PerfScope perf("C_find_rawfiles");
+
+   std::deque<WalkDir> queue;
+   std::vector<WalkFile> files;
+   std::vector< std::pair<std::string, std::string> > acqs;
+   std::mutex mtx;
+   int active = 0;
+   queue.push_back(WalkDir{ root, -1 });
+
+   #pragma omp parallel
+   {
+      for (;;) {
+          WalkDir d;
+          bool got = false, finished = false;
+          {
+             std::lock_guard<std::mutex> lock(mtx);
+             if (!queue.empty()) { d = queue.front(); queue.pop_front(); active++; got = true; }
+             else if (active==0) finished = true;
+          }
+          if (finished) break;
+          if (!got) { std::this_thread::yield(); continue; }
+
+          std::vector<std::string> fnames, dnames;
+          DIR *dp = opendir(d.path.c_str());
+          if (dp!=NULL) {
+             struct dirent *de;
+             while ((de=readdir(dp))!=NULL) {
+                 std::string name(de->d_name);
+                 if (name.empty() || name[0]=='.') continue;
+                 bool isdir;
+#if defined(_DIRENT_HAVE_D_TYPE) || defined(DT_DIR)
+                 if (de->d_type==DT_DIR) isdir = true;
+                 else if (de->d_type==DT_REG) isdir = false;
+                 else isdir = _is_dir(d.path + "/" + name);
+#else
+                 isdir = _is_dir(d.path + "/" + name);
+#endif
+                 if (isdir) dnames.push_back(name); else fnames.push_back(name);
+             }
+             closedir(dp);
+          }
+
+          // Bruker experiment directory
+          int acq = d.acq;
+          bool fexp = std::find(fnames.begin(), fnames.end(), std::string("acqus"))!=fnames.end();
+          std::string nuc, pulprog;
+          if (fexp) _read_acqus(d.path + "/acqus", nuc, pulprog);
+
+          std::vector<std::string> found;
+          for (size_t i=0; i<fnames.size(); i++)
+              if (_has_suffix(fnames[i], sfx)) found.push_back(d.path + "/" + fnames[i]);
+          {
+             std::lock_guard<std::mutex> lock(mtx);
+             if (fexp) { acqs.push_back(std::make_pair(nuc, pulprog)); acq = (int)acqs.size()-1; }
+             for (size_t i=0; i<found.size(); i++) files.push_back(WalkFile{ found[i], acq });
+             if (!(leaf && found.size()>0))
+                 for (size_t i=0; i<dnames.size(); i++) {
+                     if (fexp && subdir.size()>0 && dnames[i]!=subdir) continue;
+                     queue.push_back(WalkDir{ d.path + "/" + dnames[i], acq });
+                 }
+             active--;
+          }
+      }
+   }
+
+   int n = (int)files.size();
+   perf.add(n);
+   CharacterVector F(n), NUC(n), PULPROG(n);
+   for (int i=0; i<n; i++) {
+       F[i] = files[i].path;
+       if (files[i].acq>=0) { NUC[i] = acqs[files[i].acq].first; PULPROG[i] = acqs[files[i].acq].second; }
+   }
+   return DataFrame::create( _["file"] = F, _["NUC1"] = NUC, _["PULPROG"] = PULPROG, _["stringsAsFactors"] = false );
+}
+
+// ---------------------------------------------------
+//  Shared store of the spectra : file-backed matrix (1 row = 1 spectrum, stored contiguously)
+//  mapped in memory (mmap) on POSIX systems, so that the PSOCK workers and the native threads
+//  read and write the spectra in place, only the file name and the indices being exchanged.
+//  On Windows, the rows are read / written with positioned file I/O on the same file.
+// ---------------------------------------------------
+
+class SpecStore {
+public:
+    std::string path;
+    int nrow, ncol;
+    double *data;
+    size_t mapsize;
+#ifndef _WIN32
+    int fd;
+#else
+    FILE *fp;
+#endif
+    static const size_t HEADER = 2*sizeof(int64_t);
+
+    SpecStore(const std::string &fname, int nr, int nc) : path(fname), nrow(nr), ncol(nc), data(NULL), mapsize(0)
+    {
+       // Create a new store
+       int64_t hdr[2] = { nr, nc };
+       size_t size = HEADER + (size_t)nr*nc*sizeof(double);
+#ifndef _WIN32
+       fd = open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+       if (fd<0 || ftruncate(fd, size)!=0) _fail("Cannot create the spectra store %s");
+       _map(size);
+       memcpy((char *)data - HEADER, hdr, HEADER);
+#else
+       fp = fopen(fname.c_str(), "w+b");
+       if (fp==NULL) _fail("Cannot create the spectra store %s");
+       fwrite(hdr, 1, HEADER, fp);
+       std::vector<double> zero(nc, 0.0);
+       for (int k=0; k<nr; k++) fwrite(zero.data(), sizeof(double), nc, fp);
+       fflush(fp);
+#endif
+    }
+
+    SpecStore(const std::string &fname) : path(fname), nrow(0), ncol(0), data(NULL), mapsize(0)
+    {
+       // Attach an existing store
+       int64_t hdr[2];
+#ifndef _WIN32
+       fd = open(fname.c_str(), O_RDWR);
+       if (fd<0 || pread(fd, hdr, HEADER, 0)!=(ssize_t)HEADER) _fail("Cannot open the spectra store %s");
+       nrow = (int)hdr[0]; ncol = (int)hdr[1];
+       _map(HEADER + (size_t)nrow*ncol*sizeof(double));
+#else
+       fp = fopen(fname.c_str(), "r+b");
+       if (fp==NULL || fread(hdr, 1, HEADER, fp)!=HEADER) _fail("Cannot open the spectra store %s");
+       nrow = (int)hdr[0]; ncol = (int)hdr[1];
+#endif
+    }
+
+    ~SpecStore()
+    {
+#ifndef _WIN32
+       if (data) munmap((char *)data - HEADER, mapsize);
+       if (fd>=0) close(fd);
+#else
+       if (fp) fclose(fp);
+#endif
+    }
+
+    /* Read / write the points [i1, i1+n[ of the spectrum k (0-based) */
+    void get(int k, int i1, int n, double *out)
+    {
+#ifndef _WIN32
+       memcpy(out, data + (size_t)k*ncol + i1, n*sizeof(double));
+#else
+       _fseek(k, i1);
+       if (fread(out, sizeof(double), n, fp)!=(size_t)n) stop("Cannot read the spectra store %s", path);
+#endif
+    }
+
+    /* Rows [k0, k0+nk[ (0-based), contiguous : read within the mapping itself, or copied into buf (Windows) */
+    const double *rows(int k0, int nk, std::vector<double> &buf)
+    {
+#ifndef _WIN32
+       (void)nk; (void)buf;
+       return data + (size_t)k0*ncol;
+#else
+       buf.resize((size_t)nk*ncol);
+       for (int r=0; r<nk; r++) get(k0+r, 0, ncol, buf.data() + (size_t)r*ncol);
+       return buf.data();
+#endif
+    }
+
+    void set(int k, int i1, int n, const double *in)
+    {
+#ifndef _WIN32
+       memcpy(data + (size_t)k*ncol + i1, in, n*sizeof(double));
+#else
+       _fseek(k, i1);
+       fwrite(in, sizeof(double), n, fp);
+       fflush(fp);
+#endif
+    }
+
+private:
+    /* Failure within a constructor : the destructor is not called, so the file is closed here */
+    void _fail(const char *msg)
+    {
+#ifndef _WIN32
+       if (fd>=0) { close(fd); fd = -1; }
+#else
+       if (fp) { fclose(fp); fp = NULL; }
+#endif
+       stop(msg, path);
+    }
+
+#ifndef _WIN32
+    void _map(size_t size)
+    {
+       void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+       if (p==MAP_FAILED) _fail("Cannot map the spectra store %s");
+       mapsize = size;
+       data = (double *)((char *)p + HEADER);
+    }
+#else
+    void _fseek(int k, int i1)
+    {
+       _fseeki64(fp, (int64_t)(HEADER + ((size_t)k*ncol + i1)*sizeof(double)), SEEK_SET);
+    }
+#endif
+};
+
+// C_specstore_create : create the store within the file 'path' filled with the matrix x
+// [[Rcpp::export]]
+SEXP C_specstore_create (SEXP x, std::string path)
+{
+   NumericMatrix VV(x);
+   int n_specs = VV.nrow();
+   int count_max = VV.ncol();
+   PerfScope perf("C_specstore_create", 8.0*n_specs*count_max);
+   const double *pV = VV.begin();
+   SpecStore *st = new SpecStore(path, n_specs, count_max);
+
+   std::vector<double> row(count_max);
+   for (int k=0; k<n_specs; k++) {
+       for (int i=0; i<count_max; i++) row[i] = pV[k + (size_t)i*n_specs];
+       st->set(k, 0, count_max, row.data());
+   }
+   XPtr<SpecStore> ptr(st, true);
+   return ptr;
+}
+
+// C_specstore_attach : attach (e.g. within a worker) the store saved in the file 'path'
+// [[Rcpp::export]]
+SEXP C_specstore_attach (std::string path)
+{
+   XPtr<SpecStore> ptr(new SpecStore(path), true);
+   return ptr;
+}
+
+// C_specstore_get : points i1 to i2 (1-based, included) of the spectrum k (1-based)
+// [[Rcpp::export]]
+SEXP C_specstore_get (SEXP p, int k, int i1, int i2)
+{
+   XPtr<SpecStore> st(p);
+   if (i1<1) i1=1;
+   if (i2>st->ncol) i2=st->ncol;
+   if (k<1 || k>st->nrow || i2<i1) stop("Out of range in the spectra store");
+   NumericVector V(i2-i1+1);
+   st->get(k-1, i1-1, i2-i1+1, V.begin());
+   return V;
+}
+
+// C_specstore_set : write the vector v from the point i1 (1-based) of the spectrum k (1-based)
+// [[Rcpp::export]]
+void C_specstore_set (SEXP p, int k, int i1, NumericVector v)
+{
+   XPtr<SpecStore> st(p);
+   if (k<1 || k>st->nrow || i1<1 || i1-1+v.size()>st->ncol) stop("Out of range in the spectra store");
+   st->set(k-1, i1-1, v.size(), v.begin());
+}
+
+// C_specstore_matrix : the columns j1 to j2 (1-based, included; all if j2 = 0) of the stored matrix
+// [[Rcpp::export]]
+SEXP C_specstore_matrix (SEXP p, int j1=1, int j2=0)
+{
+   XPtr<SpecStore> st(p);
+   if (j2<=0 || j2>st->ncol) j2=st->ncol;
+   if (j1<1) j1=1;
+   int n_specs = st->nrow;
+   int ncols = j2-j1+1;
+   PerfScope perf("C_specstore_matrix", 8.0*n_specs*ncols);
+   NumericMatrix M(n_specs, ncols);
+   double *pM = M.begin();
+   std::vector<double> row(ncols);
+   for (int k=0; k<n_specs; k++) {
+       st->get(k, j1-1, ncols, row.data());
+       for (int i=0; i<ncols; i++) pM[k + (size_t)i*n_specs] = row[i];
+   }
+   return M;
+}
+
+// C_specstore_close : release the store and remove its file if funlink is true
+// [[Rcpp::export]]
+void C_specstore_close (SEXP p, bool funlink=false)
+{
+   XPtr<SpecStore> st(p);
+   std::string path = st->path;
+   st.release();
+   if (funlink) remove(path.c_str());
+}
+
+// ---------------------------------------------------
+//  Group delay of the digital filter (Bruker, JEOL) : estimation from the head of the FID and
+//  correction applied within the transform of the FID (a single forward / inverse FFT pair)
+// ---------------------------------------------------
+
+/* In-place radix-2 FFT (n power of 2), unnormalized, sign -1 (forward) or +1 (inverse) as stats::fft */
+void _fft_radix2 (std::vector< std::complex<double> > &X, int sign)
+{
+   size_t n = X.size();
+   for (size_t i=1, j=0; i<n; i++) {
+       size_t bit = n >> 1;
+       for (; j & bit; bit >>= 1) j ^= bit;
+       j ^= bit;
+       if (i<j) std::swap(X[i], X[j]);
+   }
+   std::vector< std::complex<double> > W(n/2);
+   for (size_t k=0; k<n/2; k++) W[k] = std::polar(1.0, sign*2.0*M_PI*(double)k/(double)n);
+   for (size_t len=2; len<=n; len <<= 1) {
+       size_t step = n/len;
+       for (size_t i=0; i<n; i+=len)
+           for (size_t k=0; k<len/2; k++) {
+               std::complex<double> u = X[i+k], v = X[i+k+len/2]*W[k*step];
+               X[i+k] = u+v;
+               X[i+k+len/2] = u-v;
+           }
+   }
+}
+
+/* In-place FFT of any length as stats::fft : radix-2 if n is a power of 2, otherwise Bluestein's algorithm
+   (the transform written as a convolution with a chirp, computed by radix-2 FFTs of length >= 2n-1) */
+void _fft (std::vector< std::complex<double> > &X, int sign)
+{
+   size_t n = X.size();
+   if (n<2 || (n & (n-1))==0) { _fft_radix2(X, sign); return; }
+   size_t M = 1;
+   while (M<2*n-1) M <<= 1;
+   // chirp c[j] = exp(sign.i.pi.j^2/n), j^2 taken modulo 2n to keep the accuracy of the phase
+   std::vector< std::complex<double> > c(n), A(M, 0.0), B(M, 0.0);
+   for (size_t j=0; j<n; j++) c[j] = std::polar(1.0, sign*M_PI*(double)((j*j) % (2*n))/(double)n);
+   for (size_t j=0; j<n; j++) A[j] = X[j]*c[j];
+   B[0] = std::conj(c[0]);
+   for (size_t j=1; j<n; j++) B[j] = B[M-j] = std::conj(c[j]);
+   _fft_radix2(A, -1);
+   _fft_radix2(B, -1);
+   for (size_t i=0; i<M; i++) A[i] *= B[i];
+   _fft_radix2(A, +1);
+   for (size_t k=0; k<n; k++) X[k] = c[k]*A[k]/(double)M;
+}
+
+static inline int _sign (double x) { return (x>0) - (x<0); }
+
+/* First point (0-based) whose modulus exceeds half of the maximal modulus */
+size_t _fid_halfmax (const Rcomplex *z, size_t n)
+{
+   double pmax = 0;
+   for (size_t i=0; i<n; i++) pmax = std::max(pmax, sqrt(z[i].r*z[i].r + z[i].i*z[i].i));
+   size_t k = 0;
+   while (k<n-1 && sqrt(z[k].r*z[k].r + z[k].i*z[k].i) <= pmax/2) k++;
+   return k;
+}
+
+// C_estime_grpdelay : estimation of the group delay (in points) from the zero crossings of the real and the
+//   imaginary parts of the FID just before its first point above half of its maximum
+// [[Rcpp::export]]
+double C_estime_grpdelay (ComplexVector fid)
+{
+   const Rcomplex *z = fid.begin();
+   size_t n = fid.size();
+   if (n<2) return 0;
+   size_t k0 = _fid_halfmax(z, n);
+   if (k0==0) return 0;
+   double G = 0;
+   for (int c=0; c<2; c++) {
+       std::vector<double> V(k0+1);
+       for (size_t i=0; i<=k0; i++) V[i] = c==0 ? z[i].r : z[i].i;
+       size_t k = k0, kp = 0;
+       for (size_t i=1; i<k0; i++) if (_abs(V[i])>_abs(V[kp])) kp = i;
+       if (_abs(V[kp])/_abs(V[k]) > 0.5) k = kp;
+       while (k>0 && _sign(V[k-1])==_sign(V[k])) k--;
+       G += k>0 ? 0.9999*(k + V[k-1]/(V[k-1]-V[k])) : 0;
+   }
+   return G/2;
+}
+
+// C_grpdelay_fft : spectrum of the FID (halves swapped, as stats::fft then rotation) corrected for the group
+//   delay by a linear phase ramp (oc : Omega centred, or -1 to guess it from the FID), and the corrected FID
+//   (inverse transform not normalized, as stats::fft(, inverse=TRUE)). If grpdly is zero, the FID is returned
+//   unchanged with its spectrum. Any length is accepted (radix-2 FFT for a power of 2, Bluestein otherwise);
+//   for an odd length, the rotation is by ceiling(m/2) points as the previous R code.
+// [[Rcpp::export]]
+SEXP C_grpdelay_fft (ComplexVector fid, double grpdly, int oc=-1)
+{
+   size_t m = fid.size();
+   if (m<2) stop("The FID must hold at least 2 points");
+   PerfScope perf("C_grpdelay_fft", 16.0*m);
+   const Rcomplex *z = fid.begin();
+   size_t p = (m+1)/2;
+
+   std::vector< std::complex<double> > S(m);
+   for (size_t i=0; i<m; i++) S[i] = std::complex<double>(z[i].r, z[i].i);
+   _fft(S, -1);
+
+   ComplexVector spec(m);
+   if (grpdly<=0) {
+      for (size_t k=0; k<m; k++) { spec[k].r = S[(k+p)%m].real(); spec[k].i = S[(k+p)%m].imag(); }
+      return List::create( _["fid"] = clone(fid), _["spec"] = spec );
+   }
+
+   if (oc<0) {
+      size_t k0 = _fid_halfmax(z, m);
+      oc = _sign(z[k0].r)==_sign(z[k0].i) ? 1 : 0;
+   }
+   // Rotation then phase ramp : S2[k] = S[k+p] * exp(i*2*pi*grpdly*Omega[k]); the spectrum is m*S2 and
+   // the corrected FID is the inverse transform of S2 rotated back
+   std::vector< std::complex<double> > F(m);
+   for (size_t k=0; k<m; k++) {
+       double omega = oc ? ((double)k - 0.5*m)/(double)m : (double)k/(double)m;
+       std::complex<double> s2 = S[(k+p)%m] * std::polar(1.0, 2.0*M_PI*grpdly*omega);
+       spec[k].r = m*s2.real(); spec[k].i = m*s2.imag();
+       F[(k+p)%m] = s2;
+   }
+   _fft(F, +1);
+   ComplexVector out(m);
+   for (size_t i=0; i<m; i++) { out[i].r = F[i].real(); out[i].i = F[i].imag(); }
+   return List::create( _["fid"] = out, _["spec"] = spec );
+}
+
+// ---------------------------------------------------
+//  Removal of the low frequencies of the FID by a polynomial subtraction method
+// ---------------------------------------------------
+
+/* Least-squares fit of a polynomial of degree np to x[0..n-1] (stride 2 : real or imaginary parts of
+   a complex vector, fitted at once) and subtraction of the fitted values. The basis is the discrete
+   Chebyshev (Gram) polynomials on the equally spaced points t = (2i-(n-1))/n, orthogonal on the grid
+   and given by the recurrence p(k+1) = t.p(k) - beta(k).p(k-1), beta(k) = k^2(1-k^2/n^2)/(4k^2-1),
+   so that the fit is the same as lm(x ~ poly(1:n, np)) in one pass without any model matrix */
+void _remove_lowfreq (double *z, size_t n, int np)
+{
+   np = std::min(np, (int)n-1);
+   if (np<0) return;
+   int K = np+1;
+   std::vector<double> beta(K,0.0), sr(K,0.0), si(K,0.0), nn(K,0.0), p(K);
+   double dn = (double)n;
+   for (int k=1; k<K; k++) beta[k] = k*k*(1.0-(double)k*k/(dn*dn))/(4.0*k*k-1.0);
+
+   // Projections of the real and imaginary parts onto the basis
+   for (size_t i=0; i<n; i++) {
+       double t = (2.0*i - (dn-1.0))/dn;
+       p[0] = 1.0;
+       if (K>1) p[1] = t;
+       for (int k=1; k<K-1; k++) p[k+1] = t*p[k] - beta[k]*p[k-1];
+       for (int k=0; k<K; k++) { sr[k] += z[2*i]*p[k]; si[k] += z[2*i+1]*p[k]; nn[k] += p[k]*p[k]; }
+   }
+   for (int k=0; k<K; k++) { sr[k] /= nn[k]; si[k] /= nn[k]; }
+
+   // Subtraction of the fitted values
+   for (size_t i=0; i<n; i++) {
+       double t = (2.0*i - (dn-1.0))/dn;
+       p[0] = 1.0;
+       if (K>1) p[1] = t;
+       for (int k=1; k<K-1; k++) p[k+1] = t*p[k] - beta[k]*p[k-1];
+       double fr=0.0, fi=0.0;
+       for (int k=0; k<K; k++) { fr += sr[k]*p[k]; fi += si[k]*p[k]; }
+       z[2*i] -= fr; z[2*i+1] -= fi;
+   }
+}
+
+// C_remove_lowfreq : FID minus the polynomials of degree np fitted to its real and imaginary parts
+// [[Rcpp::export]]
+ComplexVector C_remove_lowfreq (ComplexVector fid, int np=5)
+{
+   ComplexVector out = clone(fid);
+   PerfScope perf("C_remove_lowfreq", 16.0*out.size());
+   _remove_lowfreq(reinterpret_cast<double*>(out.begin()), out.size(), np);
+   return out;
+}
+
+// ---------------------------------------------------
+//  Baseline Correction Routines
+// ---------------------------------------------------
+
+/* Raw buffer versions of the baseline routines, with no R object allocation, so that they
+   can be called from within parallel loops; the exported functions below are wrappers */
+
+void _glob_seg (const double *specR, int N, int dN, double sig, double *S)
 {
-    NumericVector specR(v);
-    int N = specR.size();
     int n1, n2, i, k, count;
     double a,Vmin;
-    NumericVector S(N);
 
     S[0]=specR[0];
     S[N-1]=specR[N-1];
@@ -218,55 +1502,10 @@ SEXP C_GlobSeg (SEXP v, int dN, double sig)
                count--;
         }
     }
-
-    return S;
-}
-
-// [[Rcpp::export]]
-SEXP lowpass1 (SEXP x, double alpha)
-{
-   int k,N;
-   NumericVector VecIn(x);
-   N = VecIn.size();
-   NumericVector VecOut(N);
-   VecOut[0]=VecIn[0];
-   for (k=1; k<N; k++) VecOut[k] = VecOut[k-1] + alpha * (VecIn[k] - VecOut[k-1]);
-   return(VecOut);
-}
-
-// [[Rcpp::export]]
-double WinMoy (SEXP v, int n1, int n2)
-{
-    NumericVector specR(v);
-    int k;
-    double  moy=0.0;
-    for (k=n1; k<=n2; k++) moy += specR[k];
-    moy /= (double)(n2-n1+1);
-    return moy;
-}
-
-// [[Rcpp::export]]
-SEXP Smooth (SEXP v, int n)
-{
-    NumericVector V(v);
-    int N = V.size();
-    NumericVector S(N);
-    
-    double Wk=V[0];
-    S[0]=V[0];
-    for (int k=1; k<(N-1); k++) {
-        if (k<=n)              { Wk += (V[2*k]   + V[2*k-1]);    S[k] = Wk/(2*k+1);     }
-        if (k>n && k<=(N-n-1)) { Wk += (V[k+n]   - V[k-n-1]);    S[k] = Wk/(2*n+1);     }
-        if (k>(N-n-1))         { Wk -= (V[2*k-N] - V[2*k-N-1]);  S[k] = Wk/(2*(N-k)+1); }
-    }
-    S[N-1]=V[N-1];
-    return S;
 }
 
-// [[Rcpp::export]]
-void fitLines (SEXP s, SEXP b, int n1, int n2)
+void _fit_lines (const double *specR, double *lb, int n1, int n2)
 {
-    NumericVector specR(s), lb(b);
     int k,ni;
     double  a,diff,diff_max,lb_line;
 
@@ -281,30 +1520,27 @@ void fitLines (SEXP s, SEXP b, int n1, int n2)
         a=(specR[ni]-lb[n1])/(ni-n1);
         for (k=n1+1; k<=ni; k++)
             lb[k]=a*(k-n1)+lb[n1];
-        fitLines(specR,lb,ni,n2);
+        _fit_lines(specR,lb,ni,n2);
     }
     else
         for (k=n1; k<n2; k++)
             lb[k]=a*(k-n1)+lb[n1];
 }
 
-// [[Rcpp::export]]
-SEXP C_Estime_LB (SEXP s, int istart, int iend, double WS, double NEIGH, double sig)
+/* m1, m2 : scratch buffers of size TD */
+void _estime_lb (const double *specR, int TD, int istart, int iend, double WS, double NEIGH, double sig,
+                 double *lb, double *m1, double *m2)
 {
-   NumericVector specR(s);
    int count,n1,n2,k,cnt;
-   int TD = specR.size();
    int N = round(log2(TD));
    int ws = N>15 ? 2 : 1;
    int edgesize=10;
 
-   // Create the BL vector initialize with spectrum values
-   NumericVector lb(TD), m1(TD), m2(TD);
-
    // (s1,neigh) = (50,35) => soft, (25,15) => intermediate, (10,5) => hard
 
-   m1=Smooth(specR,WS*ws);
-   m2=Smooth(specR,4*ws);
+   for (count=0; count<TD; count++) lb[count]=0.0;
+   _smooth(specR, TD, (int)(WS*ws), m1);
+   _smooth(specR, TD, 4*ws, m2);
 
    cnt=n1=n2=0;
    for (count=0; count<TD; count++) {
@@ -322,14 +1558,97 @@ SEXP C_Estime_LB (SEXP s, int istart, int iend, double WS, double NEIGH, double
             if (cnt<NEIGH*ws) { cnt=0; continue; }
             for (k=n2; k<count; k++) lb[k] = m1[k];
             if (n1<n2) {
-                fitLines(specR,lb,n1,n2);
+                _fit_lines(specR,lb,n1,n2);
             }
             n1=count-1;
             cnt=0;
         }
    }
    if (cnt>0) for (k=n2; k<count; k++) lb[k] = m1[k];
-   if (n1<n2) fitLines(specR,lb,n1,iend-1);
+   if (n1<n2) _fit_lines(specR,lb,n1,iend-1);
+}
+
+// [[Rcpp::export]]
+SEXP C_GlobSeg (SEXP v, int dN, double sig)
+{
+    NumericVector specR(v);
+    int N = specR.size();
+    PerfScope perf("C_GlobSeg", 8.0*N);
+    NumericVector S(N);
+    _glob_seg(specR.begin(), N, dN, sig, S.begin());
+    return S;
+}
+
+// [[Rcpp::export]]
+SEXP lowpass1 (SEXP x, double alpha)
+{
+   NumericVector VecIn(x);
+   int N = VecIn.size();
+   NumericVector VecOut(N);
+   _lowpass1(VecIn.begin(), N, alpha, VecOut.begin());
+   return(VecOut);
+}
+
+// [[Rcpp::export]]
+double WinMoy (SEXP v, int n1, int n2)
+{
+    NumericVector specR(v);
+    int k;
+    double  moy=0.0;
+    for (k=n1; k<=n2; k++) moy += specR[k];
+    moy /= (double)(n2-n1+1);
+    return moy;
+}
+
+// [[Rcpp::export]]
+SEXP Smooth (SEXP v, int n)
+{
+    NumericVector V(v);
+    int N = V.size();
+    NumericVector S(N);
+    _smooth(V.begin(), N, n, S.begin());
+    return S;
+}
+
+// C_Smooth_matrix : Smooth applied to each spectrum (row) of the matrix x, in parallel by blocks of rows
+// [[Rcpp::export]]
+SEXP C_Smooth_matrix (SEXP x, int n)
+{
+    NumericMatrix VV(x);
+    NumericMatrix S(VV.nrow(), VV.ncol());
+    PerfScope perf("C_Smooth_matrix", 8.0*VV.nrow()*VV.ncol());
+    _smooth_rows(VV.begin(), VV.nrow(), VV.ncol(), n, S.begin());
+    return S;
+}
+
+// C_lowpass1_matrix : lowpass1 applied to each spectrum (row) of the matrix x, in parallel by blocks of rows
+// [[Rcpp::export]]
+SEXP C_lowpass1_matrix (SEXP x, double alpha)
+{
+    NumericMatrix VV(x);
+    NumericMatrix Y(VV.nrow(), VV.ncol());
+    PerfScope perf("C_lowpass1_matrix", 8.0*VV.nrow()*VV.ncol());
+    _lowpass1_rows(VV.begin(), VV.nrow(), VV.ncol(), alpha, Y.begin());
+    return Y;
+}
+
+// [[Rcpp::export]]
+void fitLines (SEXP s, SEXP b, int n1, int n2)
+{
+    NumericVector specR(s), lb(b);
+    _fit_lines(specR.begin(), lb.begin(), n1, n2);
+}
+
+// [[Rcpp::export]]
+SEXP C_Estime_LB (SEXP s, int istart, int iend, double WS, double NEIGH, double sig)
+{
+   NumericVector specR(s);
+   int TD = specR.size();
+   PerfScope perf("C_Estime_LB", 8.0*TD);
+
+   // Create the BL vector initialize with spectrum values
+   NumericVector lb(TD), m1(TD), m2(TD);
+   _estime_lb(specR.begin(), TD, istart, iend, WS, NEIGH, sig, lb.begin(), m1.begin(), m2.begin());
    return(lb);
 }
 
@@ -339,14 +1658,15 @@ SEXP C_Estime_LB2 (SEXP s, int istart, int iend, double WS, double NEIGH, double
    NumericVector specR(s);
    int count,n1,n2,k,cnt;
    int TD = specR.size();
+   PerfScope perf("C_Estime_LB2", 8.0*TD, false);
    int N = round(log2(TD));
    int ws = N>15 ? 2 : 1;
 
    // Create the lb vector initialize with spectrum values
    NumericVector lb(TD), m1(TD), m2(TD);
 
-   m1=Smooth(specR,WS*ws);
-   m2=Smooth(specR,4*ws);
+   _smooth(specR.begin(), TD, (int)(WS*ws), m1.begin());
+   _smooth(specR.begin(), TD, 4*ws, m2.begin());
 
    cnt=n1=n2=0;
    for (count=0; count<TD; count++) {
@@ -379,43 +1699,138 @@ SEXP C_Estime_LB2 (SEXP s, int istart, int iend, double WS, double NEIGH, double
 //  Noise estimation (cf. Bruker command 'sino' - TopSpin 3.0)
 // ---------------------------------------------------
 
+/* Noise level from the accumulated sums : SQ = sum(y^2), Som = |sum(y)|, SD = |sum(w*y)| */
+double _sino_value (double SQ, double Som, double SD, int size_m, int flg)
+{
+   if (flg==0)
+       return sqrt( (SQ - Som*Som/_abs(size_m))/_abs(size_m-1) );
+   return sqrt(( SQ - ( Som*Som + 3*SD*SD/_abs(size_m*size_m-1) )/_abs(size_m) )/_abs(size_m-1) );
+}
+
+/* Noise level of one spectrum (contiguous buffer) within the index range [n1, n2] */
+double _sino_noise (const double *V, int n1, int n2, int flg)
+{
+   int size_m = n2-n1+1;
+   int size_half = size_m/2;
+   int count, i1, i2;
+   double SQ, Som, SD;
+
+   SQ=Som=0.0;
+   for(count=n1; count<=n2; count++) {
+       SQ += V[count]*V[count];
+       Som += V[count];
+   }
+   SD=0.0;
+   if (flg!=0) {
+      for(count=0; count<size_half; count++) {
+         i1 = n1 + size_half + count;
+         i2 = n1 + size_half - count - 1 ;
+         SD += (count+1)*( V[i1] - V[i2] );
+      }
+   }
+   return _sino_value(SQ, _abs(Som), _abs(SD), size_m, flg);
+}
+
+/* Single sweep over the matrix (column-major) by blocks of rows, so that each column is read
+   as one cache line per block : accumulates the sum of each column within [istart, iend] if
+   vsum is not NULL, and the noise level of each spectrum within [n1, n2] if vnoise is not NULL.
+   The blocks are split into a fixed number of chunks, whatever the number of threads : the partial
+   sums of the chunks are reduced in chunk order, so the result is bitwise reproducible. */
+void _matrix_sweep (const double *pV, int n_specs, int istart, int iend, double *vsum,
+                    int n1, int n2, int flg, double *vnoise)
+{
+   const int RB = 8, NCHUNKS = 32;
+   int nblocks = (n_specs + RB - 1)/RB;
+   int nchunks = std::min(NCHUNKS, nblocks);
+   int size_m = n2-n1+1;
+   int size_half = size_m/2;
+   int size_s = vsum ? iend-istart+1 : 0;
+   int jlo = vsum ? istart : n1, jhi = vsum ? iend : n2;
+   if (vnoise) { jlo = std::min(jlo, n1); jhi = std::max(jhi, n2); }
+   std::vector<double> partial((size_t)nchunks*size_s, 0.0);
+
+   #pragma omp parallel for schedule(dynamic,1)
+   for (int ic=0; ic<nchunks; ic++) {
+      double *lsum = partial.data() + (size_t)ic*size_s;
+      int b1 = (int)((long)ic*nblocks/nchunks), b2 = (int)((long)(ic+1)*nblocks/nchunks);
+      for (int b=b1; b<b2; b++) {
+          int k0 = b*RB, nk = std::min(RB, n_specs-k0);
+          double SQ[RB], Som[RB], SD[RB];
+          for (int r=0; r<nk; r++) SQ[r]=Som[r]=SD[r]=0.0;
+          for (int j=jlo; j<=jhi; j++) {
+              const double *c = pV + (size_t)j*n_specs + k0;
+              if (vsum && j>=istart && j<=iend) {
+                  double s = 0.0;
+                  for (int r=0; r<nk; r++) s += c[r];
+                  lsum[j-istart] += s;
+              }
+              if (vnoise && j>=n1 && j<=n2) {
+                  // weight of the point in the 'sino' first-order term
+                  double w = 0.0;
+                  if (flg!=0 && j<n1+2*size_half)
+                      w = j>=n1+size_half ? (double)(j-n1-size_half+1) : -(double)(n1+size_half-j);
+                  for (int r=0; r<nk; r++) {
+                      SQ[r] += c[r]*c[r];
+                      Som[r] += c[r];
+                      SD[r] += w*c[r];
+                  }
+              }
+          }
+          if (vnoise)
+              for (int r=0; r<nk; r++)
+                  vnoise[k0+r] = _sino_value(SQ[r], _abs(Som[r]), _abs(SD[r]), size_m, flg);
+      }
+   }
+   if (vsum) {
+      for (int j=0; j<size_s; j++) vsum[j]=0.0;
+      for (int ic=0; ic<nchunks; ic++)
+          for (int j=0; j<size_s; j++) vsum[j] += partial[(size_t)ic*size_s + j];
+   }
+}
+
 // [[Rcpp::export]]
 SEXP C_noise_estimate (SEXP x, int n1, int n2, int flg)
 {
    NumericMatrix VV(x);
    int n_specs = VV.nrow();
-   int size_m = n2-n1+1;
-   int size_half = size_m/2;
-   int count,k, i1,i2;
-   double SQ, Som, SD;
 
    // Create the Noise vector
    NumericVector Vnoise(n_specs);
+   _matrix_sweep(VV.begin(), n_specs, 0, 0, NULL, n1, n2, flg, Vnoise.begin());
 
-   // for each spectrum
-   for (k=0; k<n_specs; k++) {
-       SQ=Som=0.0;
-       for(count=n1; count<=n2; count++) {
-           SQ += VV(k,count)*VV(k,count);
-           Som += VV(k,count);
-       }
-       Som = _abs(Som);
-       if (flg==0) {
-           Vnoise[k] =  sqrt( (SQ - Som*Som/_abs(size_m))/_abs(size_m-1) );
-       } 
-       else {
-           SD=0.0;
-           for(count=0; count<size_half; count++) {
-              i1 = n1 + size_half + count;
-              i2 = n1 + size_half - count - 1 ;
-              SD += (count+1)*( VV(k,i1) - VV(k,i2) );
-           }
-           SD = _abs(SD);
-           Vnoise[k] =  sqrt(( SQ - ( Som*Som + 3*SD*SD/_abs(size_m*size_m-1) )/_abs(size_m) )/_abs(size_m-1) );
-       }
+   return(Vnoise);
+}
+
+/* Noise level of a single vector within [n1, n2[ */
+double _noise_level (const double *V, int n1, int n2)
+{
+   double  ym, sum_y, sum_y2;
+   int i;
+   sum_y=sum_y2=0.0;
+   for (i=n1; i<n2; i++) {
+       sum_y2 += V[i]*V[i];
+       sum_y  += V[i];
    }
+   ym=_abs(sum_y);
+   return sqrt(( sum_y2 - ym*ym/_abs(n2-n1) )/_abs(n2-n1-1));
+}
+
+// C_noise_stats : mean spectrum, noise level of the mean spectrum and noise level of each
+//   spectrum within [n1, n2], computed in a single sweep over the matrix
+// [[Rcpp::export]]
+SEXP C_noise_stats (SEXP x, int n1, int n2, int flg)
+{
+   NumericMatrix VV(x);
+   int n_specs = VV.nrow();
+   int count_max = VV.ncol();
+
+   NumericVector vref(count_max);
+   NumericVector Vnoise(n_specs);
+   _matrix_sweep(VV.begin(), n_specs, 0, count_max-1, vref.begin(), n1, n2, flg, Vnoise.begin());
+   for (int count=0; count<count_max; count++) vref[count] /= (double)(n_specs);
 
-   return(Vnoise);
+   List out = List::create(_["vref"] = vref, _["ynoise"] = _noise_level(vref.begin(), n1, n2), _["vnoise"] = Vnoise);
+   return(out);
 }
 
 // ---------------------------------------------------
@@ -428,16 +1843,24 @@ SEXP C_spec_ref_interval (SEXP x, int istart, int iend, IntegerVector v)
    NumericMatrix VV(x);
    int n_specs = VV.nrow();
    int size_m = iend-istart+1;
-   int count,k;
+   int count;
    int bounds = v.length()>0 ? v.length() : n_specs ;
+   const double *pV = VV.begin();
 
    NumericVector vref(size_m);
+   double *pR = vref.begin();
 
-   for(count=0; count<size_m; count++) {
-        vref[count]=0.0;
-        for (k=0; k<bounds; k++) {
-            vref[count] += VV(v.length()>0 ? v[k] : k, istart+count);
-        }
+   if (v.length()==0) {
+       _matrix_sweep(pV, n_specs, istart, iend, pR, 0, 0, 0, NULL);
+   } else {
+       std::vector<int> rows(v.begin(), v.end());
+       #pragma omp parallel for schedule(static)
+       for(count=0; count<size_m; count++) {
+            const double *c = pV + (size_t)(istart+count)*n_specs;
+            double s = 0.0;
+            for (int k=0; k<bounds; k++) s += c[rows[k]];
+            pR[count] = s;
+       }
    }
    for (count=0; count<size_m; count++) vref[count] /= (double)(bounds);
 
@@ -459,6 +1882,7 @@ SEXP C_MedianSpec(SEXP x)
    NumericMatrix VV(x);
    int n_specs = VV.nrow();
    int count_max = VV.ncol();
+   PerfScope perf("C_MedianSpec", 8.0*n_specs*count_max);
    int position = n_specs / 2; // Euclidian division
    NumericVector out(count_max);
    for (int j = 0; j < count_max; j++) { 
@@ -479,20 +1903,9 @@ SEXP C_Derive1 (SEXP v)
 {
    NumericVector specR(v);
    int count_max = specR.size();
-   int count;
 
    NumericVector D(count_max);
-
-   for (count=0; count<count_max; count++) D[count]=0.0;
-//   D[1]=specR[1]-specR[0]; D[0]=specR[1];
-//   for (count=2; count<count_max-2; count++)
-//       D[count] = (specR[count-2]-8*specR[count-1]+8*specR[count+1]-specR[count+2])/12;
-   for (count=5; count<count_max-5; count++)
-       D[count] = (42*(specR[count+1]-specR[count-1]) + 
-                   48*(specR[count+2]-specR[count-2]) + 
-                   27*(specR[count+3]-specR[count-3]) +
-                    8*(specR[count+4]-specR[count-4]) +
-                       specR[count+5]-specR[count-5] )/512;
+   _derive11(specR.begin(), count_max, 5, count_max-6, D.begin());
    return (D);
 }
 
@@ -502,16 +1915,10 @@ SEXP C_Derive (SEXP x)
    NumericMatrix VV(x);
    int n_specs = VV.nrow();
    int count_max = VV.ncol();
-   int k, count;
+   PerfScope perf("C_Derive", 8.0*n_specs*count_max);
 
    NumericMatrix M(n_specs, count_max);
-
-   for (k=0; k<n_specs; k++) {
-       for (count=0; count<count_max; count++) M(k,count)=0.0;
-       M(k,1)=VV(k,1)-VV(k,0); M(k,0)=VV(k,1);
-       for (count=2; count<count_max-2; count++)
-            M(k,count)=(VV(k,count-2)-8*VV(k,count-1)+8*VV(k,count+1)-VV(k,count+2))/12;
-   }
+   _derive5_rows(VV.begin(), n_specs, count_max, M.begin());
    return (M);
 }
 
@@ -581,6 +1988,7 @@ SEXP C_segment_shifts (SEXP x, int idx_vref, int decal_max, int istart, int iend
    int i, k, decal, idx;
    double somref, somk;
    int bounds = v.length()>0 ? v.length() : n_specs ;
+   PerfScope perf("C_segment_shifts", 8.0*bounds*size_m);
 
    /* Spectre de reference Vref */
    NumericVector vref(size_m);
@@ -633,6 +2041,7 @@ int C_align_segment (SEXP x, SEXP s, int istart, int iend, int apodize, IntegerV
    int size_m = iend-istart+1;
    int i, k, ij, delta, moy_shift, idx;
    int bounds = v.length()>0 ? v.length() : n_specs ;
+   PerfScope perf("C_align_segment", 8.0*bounds*size_m);
 
    NumericVector vk(size_m);
 
@@ -667,6 +2076,307 @@ int C_align_segment (SEXP x, SEXP s, int istart, int iend, int apodize, IntegerV
 }
 
 
+// ---------------------------------------------------
+//  Parametric Time Warping (PTW, cf. Eilers 2004 and the ptw package) : quadratic warping function
+//  w(t) fitted by BFGS with analytic gradients of the criterion (WCC or RMS), the warped sample
+//  being s(w(t)) by linear interpolation (0 outside of the segment)
+// ---------------------------------------------------
+
+#define PTW_WCC 0
+#define PTW_RMS 1
+
+/* Reference segment and its precomputed terms for the WCC criterion */
+struct PtwRef {
+   const double *r;
+   int n, crit, tr;
+   std::vector<double> R;   // r convolved with the triangle of half width tr
+   double A;                // weighted auto-covariance of r
+};
+
+/* Convolution of x with the triangle weights 1-|k|/tr, |k|<tr (x being 0 outside of [0,n[) */
+void _ptw_triconv (const double *x, int n, int tr, double *out)
+{
+   for (int t=0; t<n; t++) {
+       double s = x[t];
+       for (int k=1; k<tr; k++) {
+           double w = 1.0 - (double)k/tr, a = 0.0;
+           if (t-k>=0) a += x[t-k];
+           if (t+k<n)  a += x[t+k];
+           s += w*a;
+       }
+       out[t] = s;
+   }
+}
+
+void _ptw_initref (PtwRef &ref, const double *r, int n, int crit, int tr)
+{
+   ref.r = r; ref.n = n; ref.crit = crit; ref.tr = std::max(tr,1);
+   ref.A = 0.0;
+   if (crit==PTW_WCC) {
+       ref.R.resize(n);
+       _ptw_triconv(r, n, ref.tr, ref.R.data());
+       for (int t=0; t<n; t++) ref.A += r[t]*ref.R[t];
+   }
+}
+
+/* Warped sample y = s(w(t)) and dy = s'(w(t)), w(t) = t + L.(p0 + p1.u + p2.u^2), u = t/L, L = n-1 */
+void _ptw_apply (const double *s, int n, const double *p, double *y, double *dy)
+{
+   double L = n-1;
+   for (int t=0; t<n; t++) {
+       double u = t/L, w = t + L*(p[0] + p[1]*u + p[2]*u*u);
+       if (!(w>=0.0 && w<=L)) { y[t]=0.0; if (dy) dy[t]=0.0; continue; }
+       int i = std::min((int)w, n-2);
+       double d = s[i+1]-s[i];
+       y[t] = s[i] + (w-i)*d;
+       if (dy) dy[t] = d;
+   }
+}
+
+/* Criterion (1 - WCC, or mean squared error) of the sample s warped with p, and its gradient g;
+   y, dy, Y : work buffers of n points */
+double _ptw_crit (const PtwRef &ref, const double *s, const double *p, double *g, double *y, double *dy, double *Y)
+{
+   int n = ref.n;
+   double L = n-1, f;
+   _ptw_apply(s, n, p, y, dy);
+   if (ref.crit==PTW_RMS) {
+       f = 0.0;
+       for (int t=0; t<n; t++) { double e = y[t]-ref.r[t]; f += e*e; Y[t] = 2.0*e/n; }
+       f /= n;
+   } else {
+       _ptw_triconv(y, n, ref.tr, Y);
+       double C=0.0, B=0.0;
+       for (int t=0; t<n; t++) { C += y[t]*ref.R[t]; B += y[t]*Y[t]; }
+       if (B<=0.0 || ref.A<=0.0) { g[0]=g[1]=g[2]=0.0; return 1.0; }
+       double sAB = sqrt(ref.A*B);
+       f = 1.0 - C/sAB;
+       for (int t=0; t<n; t++) Y[t] = -(ref.R[t] - C*Y[t]/B)/sAB;
+   }
+   // Chain rule : dy(t)/dp_j = s'(w(t)).L.u^j
+   g[0]=g[1]=g[2]=0.0;
+   for (int t=0; t<n; t++) {
+       double u = t/L, e = Y[t]*dy[t]*L;
+       g[0] += e; g[1] += e*u; g[2] += e*u*u;
+   }
+   return f;
+}
+
+/* Fit of the warping coefficients p (in : start, out : optimum) by BFGS with a backtracking line search;
+   returns the criterion at the optimum */
+double _ptw_fit (const PtwRef &ref, const double *s, double *p, double *y, double *dy, double *Y)
+{
+   const int MAXIT = 100, MAXLS = 30;
+   const double TOL = 1e-9;
+   double L = ref.n-1;
+   double H[9] = { 1,0,0, 0,1,0, 0,0,1 }, g[3], gn[3], pn[3], d[3], sv[3], yv[3];
+   double f = _ptw_crit(ref, s, p, g, y, dy, Y);
+   bool first = true;
+   _perf_count("ptw: evaluations", 1);
+   for (int it=0; it<MAXIT; it++) {
+       double dg = 0.0, dsum = 0.0;
+       for (int i=0; i<3; i++) { d[i] = -(H[3*i]*g[0] + H[3*i+1]*g[1] + H[3*i+2]*g[2]); dg += d[i]*g[i]; }
+       if (dg>=0.0) {
+           for (int i=0; i<9; i++) H[i] = (i%4==0) ? 1.0 : 0.0;
+           dg = 0.0; first = true;
+           for (int i=0; i<3; i++) { d[i] = -g[i]; dg -= g[i]*g[i]; }
+       }
+       for (int i=0; i<3; i++) dsum += _abs(d[i]);
+       if (dsum==0.0) break;
+       // The first step moves the warping function by at most one point
+       double alpha = first ? 1.0/(L*dsum) : 1.0, fn = f;
+       int ls;
+       for (ls=0; ls<MAXLS; ls++) {
+           for (int i=0; i<3; i++) pn[i] = p[i] + alpha*d[i];
+           fn = _ptw_crit(ref, s, pn, gn, y, dy, Y);
+           _perf_count("ptw: evaluations", 1);
+           if (fn <= f + 1e-4*alpha*dg) break;
+           alpha *= 0.5;
+       }
+       if (ls==MAXLS) break;
+       double sy = 0.0, yy = 0.0, smax = 0.0;
+       for (int i=0; i<3; i++) { sv[i] = pn[i]-p[i]; yv[i] = gn[i]-g[i]; sy += sv[i]*yv[i]; yy += yv[i]*yv[i]; smax = std::max(smax, _abs(sv[i])); }
+       if (sy>1e-300) {
+           if (first) for (int i=0; i<9; i++) H[i] = (i%4==0) ? sy/yy : 0.0;
+           // H <- (I - rho.s.y')H(I - rho.y.s') + rho.s.s'
+           double rho = 1.0/sy, Hy[3], yHy = 0.0;
+           for (int i=0; i<3; i++) { Hy[i] = H[3*i]*yv[0] + H[3*i+1]*yv[1] + H[3*i+2]*yv[2]; yHy += yv[i]*Hy[i]; }
+           for (int i=0; i<3; i++)
+               for (int j=0; j<3; j++)
+                   H[3*i+j] += -rho*(Hy[i]*sv[j] + sv[i]*Hy[j]) + (rho*rho*yHy + rho)*sv[i]*sv[j];
+           first = false;
+       }
+       double df = f - fn;
+       for (int i=0; i<3; i++) { p[i] = pn[i]; g[i] = gn[i]; }
+       f = fn;
+       if (df <= TOL*_abs(f) || smax*L < 1e-6) break;
+   }
+   return f;
+}
+
+/* Reported criterion : 1 - WCC or RMS */
+static inline double _ptw_report (const PtwRef &ref, double f) { return ref.crit==PTW_RMS ? sqrt(f) : f; }
+
+/* Warping of the segments of the selected spectra onto the candidate references */
+struct PtwFit {
+   int n, nsel, ncd, best;
+   std::vector<int> rows, cand;          // rows of the selected spectra, candidates (indices within rows)
+   std::vector<double> Z, P, F;          // segments, warping coefficients and criteria (candidate x spectrum)
+   std::vector<double> sumF;             // sum of the criteria for each candidate
+};
+
+/* Gather the segments [istart, iend] of the spectra v (all if empty), select the candidate references
+   (the row idx_vref if > 0, otherwise the ncand spectra the most correlated with the median spectrum),
+   warp each spectrum onto each candidate and keep the candidate giving the lowest sum of the criteria */
+void _ptw_select (const double *pV, int n_specs, int istart, int n, const IntegerVector &v, int idx_vref,
+                  int crit, int trwdth, int ncand, PtwFit &W)
+{
+   int nsel = v.length()>0 ? v.length() : n_specs;
+   int j, c;
+   W.n = n; W.nsel = nsel;
+   W.rows.resize(nsel);
+   for (j=0; j<nsel; j++) W.rows[j] = v.length()>0 ? v[j] : j;
+
+   // Gather the segments (1 row = 1 spectrum)
+   std::vector<double> &Z = W.Z;
+   Z.resize((size_t)nsel*n);
+   for (j=0; j<nsel; j++)
+       for (int t=0; t<n; t++) Z[(size_t)j*n+t] = pV[W.rows[j] + (size_t)(istart+t)*n_specs];
+
+   // Candidate references
+   std::vector<int> &cand = W.cand;
+   cand.clear();
+   if (idx_vref>0) {
+       for (j=0; j<nsel; j++) if (W.rows[j]==idx_vref-1) cand.push_back(j);
+       if (cand.empty()) stop("The reference spectrum is not within the selected spectra");
+   } else {
+       // Pre-screen : correlation of each spectrum with the median spectrum
+       std::vector<double> med(n), corr(nsel);
+       #pragma omp parallel
+       {
+          std::vector<double> col(nsel);
+          #pragma omp for
+          for (int t=0; t<n; t++) {
+              for (int k=0; k<nsel; k++) col[k] = Z[(size_t)k*n+t];
+              std::nth_element(col.begin(), col.begin()+nsel/2, col.end());
+              med[t] = col[nsel/2];
+          }
+       }
+       double mm = 0.0, sm = 0.0;
+       for (int t=0; t<n; t++) mm += med[t];
+       mm /= n;
+       for (int t=0; t<n; t++) sm += (med[t]-mm)*(med[t]-mm);
+       #pragma omp parallel for
+       for (j=0; j<nsel; j++) {
+           const double *z = &Z[(size_t)j*n];
+           double mz = 0.0, sz = 0.0, szm = 0.0;
+           for (int t=0; t<n; t++) mz += z[t];
+           mz /= n;
+           for (int t=0; t<n; t++) { sz += (z[t]-mz)*(z[t]-mz); szm += (z[t]-mz)*(med[t]-mm); }
+           corr[j] = (sz>0.0 && sm>0.0) ? szm/sqrt(sz*sm) : -2.0;
+       }
+       std::vector<int> idx(nsel);
+       for (j=0; j<nsel; j++) idx[j] = j;
+       std::stable_sort(idx.begin(), idx.end(), [&corr](int a, int b) { return corr[a]>corr[b]; });
+       cand.assign(idx.begin(), idx.begin()+std::max(1,std::min(ncand,nsel)));
+   }
+   int ncd = W.ncd = cand.size();
+
+   // Warp each spectrum onto each candidate
+   std::vector<PtwRef> refs(ncd);
+   for (c=0; c<ncd; c++) _ptw_initref(refs[c], &Z[(size_t)cand[c]*n], n, crit, trwdth);
+   W.P.assign((size_t)ncd*nsel*3, 0.0);
+   W.F.assign((size_t)ncd*nsel, 0.0);
+   int npairs = ncd*nsel, q;
+   #pragma omp parallel
+   {
+      std::vector<double> y(n), dy(n), Y(n);
+      #pragma omp for schedule(dynamic,1)
+      for (q=0; q<npairs; q++) {
+          int cc = q/nsel, jj = q%nsel;
+          if (jj==cand[cc]) continue;
+          double *p = &W.P[(size_t)q*3];
+          W.F[q] = _ptw_report(refs[cc], _ptw_fit(refs[cc], &Z[(size_t)jj*n], p, y.data(), dy.data(), Y.data()));
+      }
+   }
+   _perf_count("ptw: warps", npairs-ncd);
+
+   // Best reference : lowest sum of the criteria
+   W.best = 0;
+   W.sumF.assign(ncd, 0.0);
+   double fbest = DBL_MAX;
+   for (c=0; c<ncd; c++) {
+       for (j=0; j<nsel; j++) W.sumF[c] += W.F[(size_t)c*nsel+j];
+       if (W.sumF[c]<fbest) { fbest = W.sumF[c]; W.best = c; }
+   }
+}
+
+// C_ptw_warp : parametric time warping of the segment [istart, iend] (0-based) of the spectra v (0-based
+//   rows of x, all if empty) onto the spectrum idx_vref (1-based row, or 0 to select it), in parallel over
+//   the spectra; x is modified in place unless inplace is false (a copy being then warped).
+//   crit : 0 = WCC (triangle of width trwdth), 1 = RMS. If idx_vref is 0, the ncand spectra the most
+//   correlated with the median spectrum are tried as reference and the one giving the lowest sum of the
+//   criteria is kept (as ptw::bestref, restricted to these candidates).
+//   Returns list(int = matrix of the warped spectra, ref = 1-based row of the reference, coef = (a0, a1, a2)
+//   of w(t) = a0 + a1.t + a2.t^2 (t 0-based within the segment) for each spectrum v, crit = criterion for
+//   each spectrum v)
+// [[Rcpp::export]]
+SEXP C_ptw_warp (SEXP x, int istart, int iend, IntegerVector v, int idx_vref=0, int crit=0, int trwdth=20, int ncand=3, bool inplace=true)
+{
+   NumericMatrix VV = inplace ? NumericMatrix(x) : clone(NumericMatrix(x));
+   int n_specs = VV.nrow();
+   int n = iend-istart+1;
+   if (istart<0 || iend>=VV.ncol() || n<3) stop("Invalid segment");
+   PerfScope perf("C_ptw_warp", 8.0*(v.length()>0 ? v.length() : n_specs)*n);
+   double *pV = VV.begin();
+
+   PtwFit W;
+   _ptw_select(pV, n_specs, istart, n, v, idx_vref, crit, trwdth, ncand, W);
+   int nsel = W.nsel, best = W.best, j;
+
+   // Warped spectra written back into the matrix
+   #pragma omp parallel
+   {
+      std::vector<double> y(n);
+      #pragma omp for
+      for (j=0; j<nsel; j++) {
+          if (j==W.cand[best]) continue;
+          _ptw_apply(&W.Z[(size_t)j*n], n, &W.P[((size_t)best*nsel+j)*3], y.data(), NULL);
+          for (int t=0; t<n; t++) pV[W.rows[j] + (size_t)(istart+t)*n_specs] = y[t];
+      }
+   }
+
+   // Coefficients of w(t) = t + L.(p0 + p1.t/L + p2.(t/L)^2)
+   NumericMatrix coef(nsel, 3);
+   NumericVector fcrit(nsel);
+   double L = n-1;
+   for (j=0; j<nsel; j++) {
+       const double *p = &W.P[((size_t)best*nsel+j)*3];
+       coef(j,0) = L*p[0]; coef(j,1) = 1.0 + p[1]; coef(j,2) = p[2]/L;
+       fcrit[j] = W.F[(size_t)best*nsel+j];
+   }
+   return List::create( _["int"] = VV, _["ref"] = W.rows[W.cand[best]]+1, _["coef"] = coef, _["crit"] = fcrit );
+}
+
+// C_ptw_bestref : reference spectrum of the rows of x (the whole spectra), selected as in C_ptw_warp with
+//   idx_vref = 0, x being left untouched. Returns list(best.ref = 1-based row of the reference,
+//   cand = 1-based rows of the candidates, crit.values = sum of the criteria of each candidate)
+// [[Rcpp::export]]
+SEXP C_ptw_bestref (SEXP x, int crit=0, int trwdth=20, int ncand=3)
+{
+   NumericMatrix VV(x);
+   int n_specs = VV.nrow(), n = VV.ncol();
+   if (n<3) stop("Invalid segment");
+   PerfScope perf("C_ptw_bestref", 8.0*n_specs*n);
+
+   PtwFit W;
+   _ptw_select(VV.begin(), n_specs, 0, n, IntegerVector(0), 0, crit, trwdth, ncand, W);
+   IntegerVector cand(W.ncd);
+   for (int c=0; c<W.ncd; c++) cand[c] = W.rows[W.cand[c]]+1;
+   return List::create( _["best.ref"] = W.rows[W.cand[W.best]]+1, _["cand"] = cand,
+                        _["crit.values"] = NumericVector(W.sumF.begin(), W.sumF.end()) );
+}
+
 // ---------------------------------------------------
 //  Binning Algorithms
 // ---------------------------------------------------
@@ -703,16 +2413,7 @@ struct ErvaData {
 double C_noise_estimation(SEXP x, int n1, int n2)
 {
    NumericVector V(x);
-   double  ym, sum_y, sum_y2, y_noise;
-   int i;
-   sum_y=sum_y2=0.0;
-   for (i=n1; i<n2; i++) {
-       sum_y2 += V[i]*V[i];
-       sum_y  += V[i];
-   }
-   ym=_abs(sum_y);
-   y_noise = sqrt(( sum_y2 - ym*ym/_abs(n2-n1) )/_abs(n2-n1-1));
-   return y_noise;
+   return _noise_level(V.begin(), n1, n2);
 }
 
 /*-------- Bin Evaluation Criterion (BEC)----------------------------------*/
@@ -793,6 +2494,7 @@ SEXP C_aibin_buckets(SEXP x, SEXP b, SEXP v, SEXP l, int n1, int n2)
    List blist(l);
    struct BinData bdata;
    int i;
+   PerfScope perf("C_aibin_buckets", 8.0*NumericVector(v).size());
 
    bdata.n_buckets=0;
    bdata.VREF = as<int>(blist["VREF"]);
@@ -809,6 +2511,7 @@ SEXP C_aibin_buckets(SEXP x, SEXP b, SEXP v, SEXP l, int n1, int n2)
    // Rprintf("AIBIN: range %d - %d, vnoise=%f\n",n1,n2, bdata.vnoise);
 
    find_aibin_buckets(x, buckets,vref,&bdata,n1-1,n2-1);
+   perf.add(bdata.n_buckets);
    // Rprintf("Returned Value = %d, number of buckets found = %d\n",ret, bdata.n_buckets);
    if (bdata.n_buckets==0) return R_NilValue;
 
@@ -829,16 +2532,8 @@ double func_lorentz(double x,double x0, double s) {  return s*s/(s*s+(x-x0)*(x-x
 // Calculation of the derivative (order 4 centered)
 void Derivation (double *v1, double *v2, int count_max)
 {
-    int    count;
-
-    for (count=0; count<=count_max; count++) v2[count]=0.0;
-    for (count=6; count<=count_max-5; count++)
-        v2[count] = (42*(v1[count+1]-v1[count-1]) +
-                     48*(v1[count+2]-v1[count-2]) +
-                     27*(v1[count+3]-v1[count-3]) +
-                      8*(v1[count+4]-v1[count-4]) +
-                         v1[count+5]-v1[count-5] )/512;
-
+    // v1, v2 : 1-based arrays of count_max+1 points
+    _derive11(v1, count_max+1, 6, count_max-5, v2);
 }
 
 // [[Rcpp::export]]
@@ -936,6 +2631,7 @@ SEXP C_erva_buckets(SEXP x, SEXP b, SEXP v, SEXP l, int n1, int n2)
    List blist(l);
    struct ErvaData edata;
    int i;
+   PerfScope perf("C_erva_buckets", 8.0*NumericVector(v).size());
 
    edata.n_buckets=0;
    edata.bucketsize = as<double>(blist["bucketsize"]);
@@ -945,6 +2641,7 @@ SEXP C_erva_buckets(SEXP x, SEXP b, SEXP v, SEXP l, int n1, int n2)
    edata.ppm_min = as<double>(blist["ppm_min"]);
 
    find_erva_buckets(x, buckets,vref,&edata,n1-1,n2-1);
+   perf.add(edata.n_buckets);
    // Rprintf("Returned Value = %d, number of buckets found = %d\n",ret, edata.n_buckets);
    if (edata.n_buckets==0) return R_NilValue;
 
@@ -1007,6 +2704,7 @@ SEXP C_all_buckets_integrate (SEXP x, SEXP b, int mode)
    int n_specs = VV.nrow();
    int n_bucs = Buc.nrow();
    int k;
+   PerfScope perf("C_all_buckets_integrate", 8.0*VV.size());
 
    //Matrix of the Buckets' integration : 1 row = 1 spectrum, 1 column = 1 bucket
    NumericMatrix M(n_specs, n_bucs);
@@ -1030,64 +2728,582 @@ SEXP C_maxval_buckets (SEXP x, SEXP b)
    int n_bucs = Buc.nrow();
    int k,m;
 
-   //Matrix of the Buckets' maxval : 1 row = 1 spectrum, 1 column = 1 bucket
-   NumericMatrix M(n_specs, n_bucs);
+   //Matrix of the Buckets' maxval : 1 row = 1 spectrum, 1 column = 1 bucket
+   NumericMatrix M(n_specs, n_bucs);
+
+   // for each spectrum
+   for (k=0; k<n_specs; k++) {
+        NumericVector Y = VV(k,_);
+
+        // for each bucket
+        for (m=0; m<n_bucs; m++)
+           M(k,m) = maxC(Y, Buc(m,0), Buc(m,1));
+   }
+   return(M);
+}
+
+/* Quantile (type 7, i.e. the R default) of the n values of v, by selection - v is modified */
+double quantile_select(double *v, int n, double prob)
+{
+   double h = (n-1)*prob;
+   int lo = (int)floor(h);
+   std::nth_element(v, v+lo, v+n);
+   double qlo = v[lo];
+   if (lo+1>=n || h==lo) return qlo;
+   double qhi = *std::min_element(v+lo+1, v+n);
+   return qlo + (h-lo)*(qhi-qlo);
+}
+
+// [[Rcpp::export]]
+SEXP C_buckets_snr_filter (SEXP x, SEXP b, SEXP n, double snr, double prob)
+{
+   NumericMatrix VV(x);
+   NumericMatrix Buc(b);
+   NumericVector Vnoise(n);
+   int n_specs = VV.nrow();
+   int count_max = VV.ncol();
+   int n_bucs = Buc.nrow();
+   int m, nkeep;
+   PerfScope perf("C_buckets_snr_filter", 8.0*n_specs*count_max);
+
+   const double *pV = VV.begin();
+   const double *pB = Buc.begin();
+   const double *pN = Vnoise.begin();
+   std::vector<char> keep(n_bucs, 0);
+
+   // for each bucket : the max of each spectrum within the bucket range, divided by
+   // twice its noise level, then the 'prob' quantile of these SNR across spectra
+   #pragma omp parallel for schedule(dynamic,16)
+   for (m=0; m<n_bucs; m++) {
+       std::vector<double> snrv(n_specs);
+       int n1 = (int)pB[m];
+       int n2 = (int)pB[n_bucs+m];
+       if (n1<0) n1=0;
+       if (n2>count_max-1) n2=count_max-1;
+       const double *col = pV + (size_t)n1*n_specs;
+       for (int k=0; k<n_specs; k++) snrv[k]=col[k];
+       for (int i=n1+1; i<=n2; i++) {
+           col = pV + (size_t)i*n_specs;
+           for (int k=0; k<n_specs; k++) if (col[k]>snrv[k]) snrv[k]=col[k];
+       }
+       for (int k=0; k<n_specs; k++) snrv[k] /= 2.0*pN[k];
+       keep[m] = quantile_select(snrv.data(), n_specs, prob) > snr ? 1 : 0;
+   }
+
+   // Indexes (1-based) of the buckets to keep
+   nkeep=0;
+   for (m=0; m<n_bucs; m++) nkeep += keep[m];
+   IntegerVector idx(nkeep);
+   nkeep=0;
+   for (m=0; m<n_bucs; m++) if (keep[m]) idx[nkeep++] = m+1;
+   return(idx);
+}
+
+// [[Rcpp::export]]
+SEXP C_ppmIntMax_buckets (SEXP x, SEXP b)
+{
+   NumericMatrix VV(x);
+   NumericMatrix Buc(b);
+   int n_specs = VV.nrow();
+   int n_bucs = Buc.nrow();
+   int k,m,i;
+   double Y, sumS;
+
+   //ppm values for each bucket of the maximum of the average intensity of all spectra 
+   NumericVector P(n_bucs);
+
+   // for each bucket
+   for (m=0; m<n_bucs; m++) {
+      Y=0;
+   // for each point in the bucket range
+      for (i=Buc(m,0); i<Buc(m,1); i++) {
+          // for each spectrum
+          sumS=0; for (k=0; k<n_specs; k++) sumS += VV(k,i);
+          // Keep the ppm value if it the current intensity is over than previous.
+          if (sumS>Y) { Y=sumS; P[m]=i; }
+      }       
+   }
+   return(P);
+}
+
+// [[Rcpp::export]]
+SEXP C_buckets_CSN_normalize (SEXP b)
+{
+   NumericMatrix buckets(b);
+   int n_specs = buckets.nrow();
+   int n_bucs = buckets.ncol();
+   NumericMatrix M(n_specs, n_bucs);
+   int k, m;
+   double sumS;
+
+   // for each spectrum
+   for (k=0; k<n_specs; k++) {
+       // for each bucket
+       sumS=0.0;
+       for (m=0; m<n_bucs; m++) sumS += buckets(k,m);
+       for (m=0; m<n_bucs; m++) M(k,m) = 100000.0 * buckets(k,m)/sumS;
+   }
+   return(M);
+}
+
+/* Number of ppm values strictly greater than v, ppm being sorted in decreasing order,
+   i.e. the same as length(which(ppm>v)) but by binary search */
+int _ppm_count_gt (const double *ppm, int n, double v)
+{
+   return (int)(std::partition_point(ppm, ppm+n, [v](double a) { return a>v; }) - ppm);
+}
+
+// [[Rcpp::export]]
+SEXP C_ppm_index (SEXP p, SEXP v)
+{
+   NumericVector ppm(p);
+   NumericVector V(v);
+   int n = V.size();
+   IntegerVector idx(n);
+   for (int i=0; i<n; i++) idx[i] = _ppm_count_gt(ppm.begin(), ppm.size(), V[i]);
+   return(idx);
+}
+
+/* Median as in stats::median (mean of the two middle values for an even size) - v is modified */
+double _median_select(double *v, int n)
+{
+   int h = n/2;
+   std::nth_element(v, v+h, v+n);
+   if (n%2) return v[h];
+   return 0.5*( v[h] + *std::max_element(v, v+h) );
+}
+
+/* Index ranges of the buckets, of the reference zone and of the noise zone (see C_buckets_dataset) */
+struct BucketsIdx {
+   int iref1, iref2, inoise1, inoise2;
+};
+
+BucketsIdx _buckets_index (NumericVector ppm, NumericMatrix Buc, List blist, IntegerMatrix Bidx)
+{
+   int count_max = ppm.size();
+   int n_bucs = Buc.nrow();
+   BucketsIdx bi = { -1, -1, -1, -1 };
+
+   // ppm -> index mapping by binary search
+   for (int m=0; m<n_bucs; m++) {
+       Bidx(m,0) = _ppm_count_gt(ppm.begin(), count_max, Buc(m,0));
+       Bidx(m,1) = _ppm_count_gt(ppm.begin(), count_max, Buc(m,1));
+   }
+   if (blist.containsElementNamed("zoneref") && !Rf_isNull(blist["zoneref"])) {
+       NumericVector zref = as<NumericVector>(blist["zoneref"]);
+       bi.iref1 = _ppm_count_gt(ppm.begin(), count_max, *std::max_element(zref.begin(), zref.end()));
+       bi.iref2 = _ppm_count_gt(ppm.begin(), count_max, *std::min_element(zref.begin(), zref.end()));
+   }
+   if (blist.containsElementNamed("zonenoise") && !Rf_isNull(blist["zonenoise"])) {
+       NumericVector znoise = as<NumericVector>(blist["zonenoise"]);
+       double zmax = *std::max_element(znoise.begin(), znoise.end());
+       double zmin = *std::min_element(znoise.begin(), znoise.end());
+       bi.inoise1 = zmax>=ppm[0] ? 1 : _ppm_count_gt(ppm.begin(), count_max, zmax);
+       bi.inoise2 = zmin<=ppm[count_max-1] ? count_max-1 : _ppm_count_gt(ppm.begin(), count_max, zmin)+1;
+   }
+   return bi;
+}
+
+/* One spectrum V : integration of each bucket based on the cumulative sums S (trapezoidal rule),
+   maximum value within each bucket, noise level and integration of the reference zone. The
+   outputs of the spectrum are written with a stride of n_specs (column-major matrices) */
+void _buckets_spectrum (const double *V, double *S, int count_max, const int *pB, int n_bucs, BucketsIdx &bi,
+                        double *pM, double *pMax, double *pNoise, double *pRef, int n_specs)
+{
+   S[0]=0.0;
+   for (int i=1; i<count_max; i++) S[i] = S[i-1] + 0.5*( V[i-1] + V[i] );
+   for (int j=0; j<n_bucs; j++) {
+       int n1 = pB[j]-1, n2 = pB[n_bucs+j]-1;
+       if (n1<0) n1=0;
+       pM[(size_t)j*n_specs] = n2>n1 ? S[n2]-S[n1] : 0.0;
+   }
+   if (bi.inoise1>=0) {
+       *pNoise = _abs(_sino_noise(V, bi.inoise1, bi.inoise2, 1));
+       for (int j=0; j<n_bucs; j++) {
+           int n1 = pB[j] > 0 ? pB[j] : 0;
+           int n2 = pB[n_bucs+j] < count_max ? pB[n_bucs+j] : count_max-1;
+           double vmax = V[n1];
+           for (int i=n1+1; i<=n2; i++) if (V[i]>vmax) vmax=V[i];
+           pMax[(size_t)j*n_specs] = vmax;
+       }
+   }
+   *pRef = bi.iref1>=0 && bi.iref2>bi.iref1 ? S[bi.iref2]-S[bi.iref1] : 1.0;
+}
+
+/* Normalization of the buckets dataset M, then division by the integral of the reference signal */
+void _buckets_normalize (NumericMatrix M, int norm, BucketsIdx &bi, const double *pRef)
+{
+   int n_specs = M.nrow();
+   int n_bucs = M.ncol();
+   double *pM = M.begin();
+   int k, m;
+
+   if (norm>0) {
+       // Constant Sum Normalization
+       for (k=0; k<n_specs; k++) {
+           double sumS=0.0;
+           for (m=0; m<n_bucs; m++) sumS += M(k,m);
+           for (m=0; m<n_bucs; m++) M(k,m) = 100000.0*M(k,m)/sumS;
+       }
+   }
+   if (norm==2) {
+       // Probabilistic Quotient Normalization : the reference is the median spectrum,
+       // then each spectrum is divided by the median of its quotients to the reference
+       std::vector<double> Mref(n_bucs);
+       #pragma omp parallel for schedule(static)
+       for (m=0; m<n_bucs; m++) {
+           std::vector<double> y(pM + (size_t)m*n_specs, pM + (size_t)(m+1)*n_specs);
+           std::nth_element(y.begin(), y.begin() + n_specs/2, y.end());
+           Mref[m] = y[n_specs/2];
+       }
+       #pragma omp parallel for schedule(static)
+       for (k=0; k<n_specs; k++) {
+           std::vector<double> q;
+           q.reserve(n_bucs);
+           for (int j=0; j<n_bucs; j++)
+               if (Mref[j]!=0.0) q.push_back(pM[k + (size_t)j*n_specs]/Mref[j]);
+           double coeff = q.size()>0 ? _median_select(q.data(), q.size()) : 1.0;
+           for (int j=0; j<n_bucs; j++) pM[k + (size_t)j*n_specs] /= coeff;
+       }
+   }
+
+   // if supplied, divide by the integral of the reference signal
+   if (bi.iref1>=0)
+       for (m=0; m<n_bucs; m++)
+           for (k=0; k<n_specs; k++) M(k,m) /= pRef[k];
+}
+
+// C_buckets_dataset : builds in one pass the buckets dataset from the matrix of spectra
+//   p : ppm vector (decreasing order), b : buckets as ppm ranges (1 row = (max, min))
+//   l : list( norm = 0 (none) | 1 (CSN) | 2 (PQN), zoneref = ppm range of the reference or NULL,
+//             zonenoise = ppm range of the noise or NULL )
+//   Returns the bucket index ranges, the (normalized) integrations and, if zonenoise is given,
+//   the maximum value of each bucket and the noise level of each spectrum.
+// [[Rcpp::export]]
+SEXP C_buckets_dataset (SEXP x, SEXP p, SEXP b, SEXP l)
+{
+   NumericMatrix VV(x);
+   NumericVector ppm(p);
+   NumericMatrix Buc(b);
+   List blist(l);
+   int n_specs = VV.nrow();
+   int count_max = VV.ncol();
+   int n_bucs = Buc.nrow();
+   int norm = as<int>(blist["norm"]);
+   int k;
+   PerfScope perf("C_buckets_dataset", 8.0*n_specs*count_max);
+
+   IntegerMatrix Bidx(n_bucs, 2);
+   BucketsIdx bi = _buckets_index(ppm, Buc, blist, Bidx);
+
+   NumericMatrix M(n_specs, n_bucs);
+   NumericMatrix MaxVals(bi.inoise1<0 ? 0 : n_specs, bi.inoise1<0 ? 0 : n_bucs);
+   NumericVector Vnoise(bi.inoise1<0 ? 0 : n_specs);
+   NumericVector Vref(n_specs);
+
+   const double *pV = VV.begin();
+   const int *pB = Bidx.begin();
+   double *pM = M.begin();
+   double *pMax = MaxVals.begin();
+   double *pNoise = Vnoise.begin();
+   double *pRef = Vref.begin();
+
+   // for each spectrum
+   #pragma omp parallel for schedule(static)
+   for (k=0; k<n_specs; k++) {
+       std::vector<double> V(count_max), S(count_max);
+       for (int i=0; i<count_max; i++) V[i] = pV[k + (size_t)i*n_specs];
+       _buckets_spectrum(V.data(), S.data(), count_max, pB, n_bucs, bi,
+                         pM + k, bi.inoise1>=0 ? pMax + k : NULL, bi.inoise1>=0 ? pNoise + k : NULL, pRef + k, n_specs);
+   }
+
+   // Normalization
+   _buckets_normalize(M, norm, bi, pRef);
+
+   return Rcpp::List::create(_["buckets"] = Bidx,
+                             _["int"] = M,
+                             _["maxvals"] = MaxVals,
+                             _["noise"] = Vnoise );
+}
+
+
+// ---------------------------------------------------
+//  Normalization of the Intensities
+// ---------------------------------------------------
+
+/* Gather the values of the spectrum k within the zones (column-major matrix) */
+void _zones_values(const double *pV, int n_specs, const std::vector<int> &zones, int k, std::vector<double> &buf)
+{
+   buf.clear();
+   for (size_t z=0; z<zones.size(); z+=2)
+       for (int i=zones[z]; i<=zones[z+1]; i++) buf.push_back(pV[k + (size_t)i*n_specs]);
+}
+
+/* Histogram matching : shift (in log2 scale) to apply to the spectrum values so that their
+   histogram best matches the reference one (cf. Torgrip et al. 2008) */
+double _hist_shift(const std::vector<double> &vals, const std::vector<double> &Href, double lmin, double wbin, int nfine, int fac, int smax)
+{
+   std::vector<double> C(nfine+1, 0.0);
+   int nv = 0;
+   for (size_t i=0; i<vals.size(); i++) {
+       if (vals[i]<=0.0) continue;
+       int b = (int)floor((log2(vals[i])-lmin)/wbin);
+       if (b>=0 && b<nfine) { C[b+1] += 1.0; nv++; }
+   }
+   if (nv==0) return 0.0;
+   for (int b=1; b<=nfine; b++) C[b] = C[b-1] + C[b]/nv;
+   int ncoarse = nfine/fac;
+   double best=DBL_MAX;
+   int sbest=0;
+   for (int s=-smax; s<=smax; s++) {
+       double sse=0.0;
+       for (int c=0; c<ncoarse; c++) {
+           int f1 = c*fac - s, f2 = f1 + fac;
+           f1 = f1<0 ? 0 : (f1>nfine ? nfine : f1);
+           f2 = f2<0 ? 0 : (f2>nfine ? nfine : f2);
+           double d = (C[f2]-C[f1]) - Href[c];
+           sse += d*d;
+       }
+       if (sse<best) { best=sse; sbest=s; }
+   }
+   return sbest*wbin;
+}
+
+/* Index ranges (0-based, included) of the zones given as a matrix of 1-based index ranges */
+std::vector<int> _norm_zones (NumericMatrix Z, int count_max)
+{
+   std::vector<int> zones;
+   for (int i=0; i<Z.nrow(); i++) {
+       int i1 = (int)Z(i,0)-1, i2 = (int)Z(i,1)-1;
+       if (i1<0) i1=0;
+       if (i2>count_max-1) i2=count_max-1;
+       if (i2<i1) continue;
+       zones.push_back(i1); zones.push_back(i2);
+   }
+   return zones;
+}
+
+/* Histogram of the reference (log2 scale) : fine bins (wbin) gathered by 'fac' into coarse ones */
+void _hist_reference (const std::vector<double> &Vref, double wbin, int fac, int smax,
+                      double &lmin, int &nfine, std::vector<double> &Href)
+{
+   int npts = Vref.size();
+   double lo=DBL_MAX, hi=-DBL_MAX;
+   for (int j=0; j<npts; j++) if (Vref[j]>0.0) { lo = std::min(lo, log2(Vref[j])); hi = std::max(hi, log2(Vref[j])); }
+   if (lo>hi) { lo=0.0; hi=1.0; }
+   lmin = lo - smax*wbin;
+   nfine = fac*(int)ceil((hi - lmin + smax*wbin)/(fac*wbin));
+   std::vector<double> C(nfine+1, 0.0);
+   int nv=0;
+   for (int j=0; j<npts; j++) {
+       if (Vref[j]<=0.0) continue;
+       int b = (int)floor((log2(Vref[j])-lmin)/wbin);
+       if (b>=0 && b<nfine) { C[b+1] += 1.0; nv++; }
+   }
+   Href.assign(nfine/fac, 0.0);
+   for (int b=0; b<nfine; b++) Href[b/fac] += nv>0 ? C[b+1]/nv : 0.0;
+}
+
+/* Normalization coefficient of the spectrum k (column-major matrix) within the zones */
+double _norm_coeff(const double *pV, int n_specs, const std::vector<int> &zones, int npts, int k, int meth,
+                   const std::vector<double> &Vref, const std::vector<double> &Href, double lmin, double wbin,
+                   int nfine, int fac, int smax, std::vector<double> &buf)
+{
+   _zones_values(pV, n_specs, zones, k, buf);
+   double c = 1.0;
+   if (meth==1) {
+       c = 0.0;
+       for (size_t i=0, p=0; i<zones.size(); i+=2) {
+           int n = zones[i+1]-zones[i]+1;
+           c += 0.5*( buf[p] + buf[p+n-1] );
+           for (int m=1; m<n-1; m++) c += buf[p+m];
+           p += n;
+       }
+   }
+   if (meth==2) {
+       int nq=0;
+       for (int j=0; j<npts; j++) if (Vref[j]!=0.0) buf[nq++] = buf[j]/Vref[j];
+       c = nq>0 ? _median_select(buf.data(), nq) : 1.0;
+   }
+   if (meth==3) c = pow(2.0, -_hist_shift(buf, Href, lmin, wbin, nfine, fac, smax));
+   if (meth==4) c = npts>0 ? quantile_select(buf.data(), npts, 0.75) : 1.0;
+   return c;
+}
+
+// C_spectra_normalize : normalization of the spectra based on the selected zones;
+//   z : matrix of the index ranges (1-based) of the zones, one zone per row
+//   meth : 1 = CSN (Constant Sum), 2 = PQN (Probabilistic Quotient), 3 = HIST (Histogram Matching),
+//          4 = QUANT (3rd quartile of the intensities)
+//   r : if not NULL, matrix of spectra already normalized (same ppm scale) on which both the
+//       reference (PQN, HIST) and the mean coefficient (CSN, QUANT) are based instead of x
+//   inplace : if false, x is left untouched and the spectra are divided in a copy
+//   Each spectrum is divided by its coefficient; returns the matrix of the normalized spectra.
+// [[Rcpp::export]]
+SEXP C_spectra_normalize (SEXP x, SEXP z, int meth, SEXP r = R_NilValue, bool inplace=true)
+{
+   NumericMatrix VV = inplace ? NumericMatrix(x) : clone(NumericMatrix(x));
+   int n_specs = VV.nrow();
+   int count_max = VV.ncol();
+   int k, npts;
+   PerfScope perf("C_spectra_normalize", 8.0*n_specs*count_max);
+
+   std::vector<int> zones = _norm_zones(NumericMatrix(z), count_max);
+   npts=0;
+   for (size_t i=0; i<zones.size(); i+=2) npts += zones[i+1]-zones[i]+1;
+
+   double *pV = VV.begin();
+   NumericVector COEFF(n_specs);
+   double *pC = COEFF.begin();
+
+   // Spectra on which the reference is based
+   const double *pR = pV;
+   int n_refs = n_specs;
+   NumericMatrix RR;
+   if (!Rf_isNull(r)) {
+       RR = NumericMatrix(r);
+       pR = RR.begin();
+       n_refs = RR.nrow();
+   }
+
+   // Reference spectrum for PQN & HIST: median of each point over all spectra (contiguous columns)
+   std::vector<double> Vref;
+   if (meth==2 || meth==3) {
+       Vref.resize(npts);
+       std::vector<int> cols;
+       for (size_t i=0; i<zones.size(); i+=2)
+           for (int j=zones[i]; j<=zones[i+1]; j++) cols.push_back(j);
+       #pragma omp parallel for schedule(static)
+       for (int j=0; j<npts; j++) {
+           std::vector<double> y(pR + (size_t)cols[j]*n_refs, pR + (size_t)(cols[j]+1)*n_refs);
+           Vref[j] = _median_select(y.data(), n_refs);
+       }
+   }
+
+   // Histogram of the reference (log2 scale) : fine bins (wbin) gathered by 'fac' into coarse ones
+   double wbin=0.01, lmin=0.0;
+   int fac=10, smax=500, nfine=0;
+   std::vector<double> Href;
+   if (meth==3) _hist_reference(Vref, wbin, fac, smax, lmin, nfine, Href);
 
-   // for each spectrum
+   // Coefficient of each spectrum
+   #pragma omp parallel for schedule(dynamic,4)
    for (k=0; k<n_specs; k++) {
-        NumericVector Y = VV(k,_);
+       std::vector<double> buf;
+       buf.reserve(npts);
+       pC[k] = _norm_coeff(pV, n_specs, zones, npts, k, meth, Vref, Href, lmin, wbin, nfine, fac, smax, buf);
+   }
 
-        // for each bucket
-        for (m=0; m<n_bucs; m++)
-           M(k,m) = maxC(Y, Buc(m,0), Buc(m,1));
+   // CSN & QUANT : coefficients relative to their mean (over the reference spectra if given)
+   if (meth==1 || meth==4) {
+       double moy=0.0;
+       if (pR==pV) {
+           for (k=0; k<n_specs; k++) moy += pC[k];
+       } else {
+           #pragma omp parallel for schedule(dynamic,4) reduction(+:moy)
+           for (k=0; k<n_refs; k++) {
+               std::vector<double> buf;
+               buf.reserve(npts);
+               moy += _norm_coeff(pR, n_refs, zones, npts, k, meth, Vref, Href, lmin, wbin, nfine, fac, smax, buf);
+           }
+       }
+       moy /= (pR==pV ? n_specs : n_refs);
+       for (k=0; k<n_specs; k++) pC[k] /= moy;
    }
-   return(M);
+   for (k=0; k<n_specs; k++) if (pC[k]==0.0 || !std::isfinite(pC[k])) pC[k]=1.0;
+
+   // Apply to each spectrum its corresponding coefficient
+   #pragma omp parallel for schedule(static)
+   for (int j=0; j<count_max; j++) {
+       double *col = pV + (size_t)j*n_specs;
+       for (int i=0; i<n_specs; i++) col[i] /= pC[i];
+   }
+
+   return(VV);
 }
 
-// [[Rcpp::export]]
-SEXP C_ppmIntMax_buckets (SEXP x, SEXP b)
-{
-   NumericMatrix VV(x);
-   NumericMatrix Buc(b);
-   int n_specs = VV.nrow();
-   int n_bucs = Buc.nrow();
-   int k,m,i;
-   double Y, sumS;
 
-   //ppm values for each bucket of the maximum of the average intensity of all spectra 
-   NumericVector P(n_bucs);
+// ---------------------------------------------------
+//  Assembly of the Matrix of spectra onto a common ppm grid
+// ---------------------------------------------------
 
-   // for each bucket
-   for (m=0; m<n_bucs; m++) {
-      Y=0;
-   // for each point in the bucket range
-      for (i=Buc(m,0); i<Buc(m,1); i++) {
-          // for each spectrum
-          sumS=0; for (k=0; k<n_specs; k++) sumS += VV(k,i);
-          // Keep the ppm value if it the current intensity is over than previous.
-          if (sumS>Y) { Y=sumS; P[m]=i; }
-      }       
+#define RESAMPLE_LINEAR  1
+#define RESAMPLE_CUBIC   2
+#define RESAMPLE_SINC    3
+#define SINC_HALFWIDTH   8
+
+double _sinc(double x)
+{
+   if (fabs(x)<1e-12) return 1.0;
+   double px = 3.14159265358979323846*x;
+   return sin(px)/px;
+}
+
+/* Value of the spectrum y (n points on an increasing uniform ppm scale, starting at pmin with step dppm)
+   interpolated at the ppm value t; 0 outside the spectral width of the spectrum */
+double _resample_value(const double *y, int n, double pmin, double dppm, double t, int meth)
+{
+   double p = (t - pmin)/dppm;
+   if (n<1 || p < -0.5 || p > n-0.5) return 0.0;
+   if (n==1) return y[0];
+   if (p<0) p=0;
+   if (p>n-1) p=n-1;
+   int j = (int)floor(p);
+   if (j>n-2) j=n-2;
+   double u = p - j;
+   if (meth==RESAMPLE_CUBIC) {
+       // Cubic convolution (Keys, a=-0.5), the edge points being duplicated
+       double y0 = y[j>0 ? j-1 : 0], y1 = y[j], y2 = y[j+1], y3 = y[j+2<n ? j+2 : n-1];
+       return y1 + 0.5*u*( y2 - y0 + u*( 2*y0 - 5*y1 + 4*y2 - y3 + u*( 3*(y1 - y2) + y3 - y0 ) ) );
    }
-   return(P);
+   if (meth==RESAMPLE_SINC) {
+       // Lanczos windowed sinc, normalized by the sum of the weights
+       if (u<1e-12) return y[j];
+       double s=0.0, w=0.0;
+       for (int m=j-SINC_HALFWIDTH+1; m<=j+SINC_HALFWIDTH; m++) {
+           double d = p - m;
+           double wm = _sinc(d)*_sinc(d/SINC_HALFWIDTH);
+           s += wm*y[m<0 ? 0 : (m>n-1 ? n-1 : m)];
+           w += wm;
+       }
+       return w!=0.0 ? s/w : y[j];
+   }
+   return (1.0-u)*y[j] + u*y[j+1];
 }
 
+// C_spectra_resample : builds the matrix of spectra (1 row = 1 spectrum) on the common ppm grid;
+//   l : list of the intensity vectors, pmin & dppm : their ppm scales (increasing order)
+//   ppm : the common ppm grid (decreasing order), meth : 1 = linear, 2 = cubic, 3 = sinc
+//   The matrix is allocated once and its rows are filled in parallel.
 // [[Rcpp::export]]
-SEXP C_buckets_CSN_normalize (SEXP b)
+SEXP C_spectra_resample (SEXP l, SEXP pmin, SEXP dppm, SEXP ppm, int meth)
 {
-   NumericMatrix buckets(b);
-   int n_specs = buckets.nrow();
-   int n_bucs = buckets.ncol();
-   NumericMatrix M(n_specs, n_bucs);
-   int k, m;
-   double sumS;
+   List L(l);
+   NumericVector P0(pmin), DP(dppm), PPM(ppm);
+   int n_specs = L.size();
+   int count_max = PPM.size();
+   int k;
+   PerfScope perf("C_spectra_resample", 8.0*n_specs*count_max);
 
-   // for each spectrum
+   // Pointers to the spectra gathered before entering the parallel region (no R API within the threads)
+   std::vector<const double*> Y(n_specs);
+   std::vector<int> N(n_specs);
    for (k=0; k<n_specs; k++) {
-       // for each bucket
-       sumS=0.0;
-       for (m=0; m<n_bucs; m++) sumS += buckets(k,m);
-       for (m=0; m<n_bucs; m++) M(k,m) = 100000.0 * buckets(k,m)/sumS;
+       NumericVector v = L[k];
+       Y[k] = v.begin();
+       N[k] = v.size();
    }
+
+   NumericMatrix M(n_specs, count_max);
+   double *pM = M.begin();
+   const double *pP = PPM.begin();
+   const double *p0 = P0.begin();
+   const double *dp = DP.begin();
+
+   #pragma omp parallel for schedule(static)
+   for (k=0; k<n_specs; k++)
+       for (int i=0; i<count_max; i++)
+           pM[k + (size_t)i*n_specs] = _resample_value(Y[k], N[k], p0[k], dp[k], pP[i], meth);
+
    return(M);
 }
 
@@ -1179,6 +3395,7 @@ SEXP C_corr_spec_re (SEXP l)
    double phc1 = as<double>(spec["phc1"]);
    int n = re.size();
    double phi;
+   PerfScope perf("C_corr_spec_re", 16.0*n);
 
    NumericVector S_re(n);
    NumericVector S_im(n);
@@ -1210,6 +3427,7 @@ double Fmin(SEXP par, SEXP re, SEXP im, int blphc, double B, int flg=0)
    const size_t n2 = (size_t)(n/24);
    size_t i;
    double phi, Xmin, Xmax, SS;
+   PerfScope perf("Fmin", 16.0*n, false);
 
    NumericVector X(n);
    for (i=0; i<n; i++) {
@@ -1252,6 +3470,7 @@ double Fentropy(SEXP par, SEXP re, SEXP im, int blphc, int neigh, double B, doub
    const size_t n = (size_t)(Re.size());
    size_t i;
    double phi, sumD, H1, Pfun, sumax, sumax2;
+   PerfScope perf("Fentropy", 16.0*n, false);
 
    // X = real( data * exp(1j * (phase0 + phase1 * x)) )
    NumericVector X(n);
@@ -1304,3 +3523,833 @@ double Fentropy(SEXP par, SEXP re, SEXP im, int blphc, int neigh, double B, doub
    return(H1 + Gamma * Pfun);
 }
 
+
+// ---------------------------------------------------
+//  Correlation-based Clustering of the Buckets
+// ---------------------------------------------------
+
+/* Ranks of a vector (average ranks for ties, as in base::rank) */
+void _rank_avg(const double *x, int n, double *r)
+{
+   std::vector<int> idx(n);
+   for (int i=0; i<n; i++) idx[i]=i;
+   std::sort(idx.begin(), idx.end(), [x](int a, int b) { return x[a]<x[b]; });
+   int i=0;
+   while (i<n) {
+       int j=i;
+       while (j+1<n && x[idx[j+1]]==x[idx[i]]) j++;
+       double rk = 0.5*(i+j) + 1.0;
+       for (int m=i; m<=j; m++) r[idx[m]] = rk;
+       i=j+1;
+   }
+}
+
+// C_corr_matrix : correlation matrix of the columns of x (samples x variables) computed in parallel;
+//   rank = 0 : Pearson, rank = 1 : Spearman. Only the upper triangle is filled, the lower triangle
+//   and the diagonal are set to 0. The correlations involving a constant column are NaN (NA as with
+//   stats::cor).
+// [[Rcpp::export]]
+SEXP C_corr_matrix (SEXP x, int rank)
+{
+   NumericMatrix X(x);
+   int n = X.nrow();
+   int p = X.ncol();
+   int j;
+   const double *pX = X.begin();
+
+   // Centered and scaled columns : the correlations are then simple dot products
+   std::vector<double> Z((size_t)n*p);
+   #pragma omp parallel for schedule(static)
+   for (j=0; j<p; j++) {
+       double *z = Z.data() + (size_t)j*n;
+       if (rank) _rank_avg(pX + (size_t)j*n, n, z);
+       else      std::copy(pX + (size_t)j*n, pX + (size_t)(j+1)*n, z);
+       double m=0.0, ss=0.0;
+       for (int k=0; k<n; k++) m += z[k];
+       m /= n;
+       for (int k=0; k<n; k++) { z[k] -= m; ss += z[k]*z[k]; }
+       ss = ss>0.0 ? 1.0/sqrt(ss) : NAN;
+       for (int k=0; k<n; k++) z[k] *= ss;
+   }
+
+   NumericMatrix C(p, p);
+   double *pC = C.begin();
+   #pragma omp parallel for schedule(dynamic,8)
+   for (j=0; j<p; j++) {
+       const double *zj = Z.data() + (size_t)j*n;
+       double *cj = pC + (size_t)j*p;
+       for (int i=0; i<j; i++) {
+           const double *zi = Z.data() + (size_t)i*n;
+           double s=0.0;
+           for (int k=0; k<n; k++) s += zi[k]*zj[k];
+           cj[i] = std::isfinite(s) ? std::max(-1.0, std::min(1.0, s)) : NAN;
+       }
+   }
+   return(C);
+}
+
+/* Union-Find with path halving and union by size */
+struct UnionFind
+{
+   std::vector<int> parent, size;
+   UnionFind(int n) : parent(n), size(n, 1) { for (int i=0; i<n; i++) parent[i]=i; }
+   int find(int a) {
+       while (parent[a]!=a) { parent[a] = parent[parent[a]]; a = parent[a]; }
+       return a;
+   }
+};
+
+struct CorrEdge { double c; int i, j; };
+
+/* Edges (i<j) of the upper triangle of the correlation matrix for which the correlation is greater
+   than cmin (NaN excluded), sorted by decreasing correlation */
+void _corr_edges(const double *pC, int p, double cmin, std::vector<CorrEdge> &edges)
+{
+   std::vector< std::vector<CorrEdge> > cols(p);
+   #pragma omp parallel for schedule(dynamic,16)
+   for (int j=0; j<p; j++)
+       for (int i=0; i<j; i++) {
+           double c = pC[(size_t)j*p + i];
+           if (std::isfinite(c) && c>cmin) cols[j].push_back(CorrEdge{c, i, j});
+       }
+   edges.clear();
+   for (int j=0; j<p; j++) edges.insert(edges.end(), cols[j].begin(), cols[j].end());
+   std::sort(edges.begin(), edges.end(), [](const CorrEdge &a, const CorrEdge &b) { return a.c>b.c; });
+}
+
+/* Order of the cvals by decreasing value, so that the edges are added once in a single sweep */
+std::vector<int> _cvals_order(const NumericVector &cvals)
+{
+   std::vector<int> ord(cvals.size());
+   for (size_t i=0; i<ord.size(); i++) ord[i]=i;
+   std::sort(ord.begin(), ord.end(), [&cvals](int a, int b) { return cvals[a]>cvals[b]; });
+   return ord;
+}
+
+// C_corr_cvals_stats : for each correlation threshold cval, statistics on the connected components of the
+//   graph whose edges are the pairs of variables with a correlation greater than cval.
+//   Returns a matrix with one row per cval : (cval, nb clusters, nb vars, max size, nb clusters of size 2, criterion)
+// [[Rcpp::export]]
+SEXP C_corr_cvals_stats (SEXP c, NumericVector cvals)
+{
+   NumericMatrix C(c);
+   int p = C.ncol();
+   int ncvals = cvals.size();
+   NumericMatrix V(ncvals, 6);
+   if (ncvals==0) return(V);
+
+   std::vector<int> ord = _cvals_order(cvals);
+   std::vector<CorrEdge> edges;
+   _corr_edges(C.begin(), p, cvals[ord[ncvals-1]], edges);
+
+   UnionFind uf(p);
+   int nb_clusters=0, nb_clusters_2=0, nb_vars=0, size_max = p>0 ? 1 : 0;
+   size_t e=0;
+   for (int m=0; m<ncvals; m++) {
+       double cval = cvals[ord[m]];
+       for (; e<edges.size() && edges[e].c>cval; e++) {
+           int a = uf.find(edges[e].i), b = uf.find(edges[e].j);
+           if (a==b) continue;
+           int sa = uf.size[a], sb = uf.size[b];
+           if (sa>=2) { nb_clusters--; nb_vars -= sa; }
+           if (sb>=2) { nb_clusters--; nb_vars -= sb; }
+           if (sa==2) nb_clusters_2--;
+           if (sb==2) nb_clusters_2--;
+           if (sa<sb) std::swap(a, b);
+           uf.parent[b] = a;
+           uf.size[a] = sa+sb;
+           nb_clusters++; nb_vars += sa+sb;
+           if (sa+sb==2) nb_clusters_2++;
+           if (sa+sb>size_max) size_max = sa+sb;
+       }
+       int r = ord[m];
+       V(r,0) = cval;
+       V(r,1) = nb_clusters;
+       V(r,2) = nb_vars;
+       V(r,3) = size_max;
+       V(r,4) = nb_clusters_2;
+       V(r,5) = -20*log10((double)size_max/nb_clusters);
+   }
+   return(V);
+}
+
+// C_corr_cvals_clusters : cluster of each variable for each correlation threshold cval; the clusters
+//   (connected components of size >= mincsize) are numbered by decreasing size, 0 if none.
+// [[Rcpp::export]]
+SEXP C_corr_cvals_clusters (SEXP c, NumericVector cvals, int mincsize)
+{
+   NumericMatrix C(c);
+   int p = C.ncol();
+   int ncvals = cvals.size();
+   IntegerMatrix L(p, ncvals);
+   if (ncvals==0) return(L);
+
+   std::vector<int> ord = _cvals_order(cvals);
+   std::vector<CorrEdge> edges;
+   _corr_edges(C.begin(), p, cvals[ord[ncvals-1]], edges);
+
+   UnionFind uf(p);
+   size_t e=0;
+   for (int m=0; m<ncvals; m++) {
+       double cval = cvals[ord[m]];
+       for (; e<edges.size() && edges[e].c>cval; e++) {
+           int a = uf.find(edges[e].i), b = uf.find(edges[e].j);
+           if (a==b) continue;
+           if (uf.size[a]<uf.size[b]) std::swap(a, b);
+           uf.parent[b] = a;
+           uf.size[a] += uf.size[b];
+       }
+       // Components ordered by decreasing size, then by their first variable
+       std::vector<int> first(p, -1), roots;
+       for (int i=0; i<p; i++) {
+           int r = uf.find(i);
+           if (first[r]<0) { first[r]=i; roots.push_back(r); }
+       }
+       std::stable_sort(roots.begin(), roots.end(), [&uf](int a, int b) { return uf.size[a]>uf.size[b]; });
+       std::vector<int> label(p, 0);
+       int g=0;
+       for (size_t k=0; k<roots.size(); k++)
+           if (uf.size[roots[k]]>=mincsize) label[roots[k]] = ++g;
+       for (int i=0; i<p; i++) L(i, ord[m]) = label[uf.find(i)];
+   }
+   return(L);
+}
+
+// ---------------------------------------------------
+//  Fused Pipeline of the per-spectrum processing stages
+// ---------------------------------------------------
+
+#define STAGE_GBASELINE 1
+#define STAGE_QNMRBL    2
+#define STAGE_FILTER    3
+#define STAGE_ZERO      4
+#define STAGE_SHIFT     5
+#define STAGE_CALIB     6
+#define STAGE_BASELINE  7
+
+struct PipeStage {
+   int type;
+   int i1, i2;                 // index range of the zone (as computed on the R side, 1-based)
+   int n1, n2;                 // index range of the noise area (1-based)
+   double p1, p2;              // stage parameters (gbaseline: WS, NEIGH; qnmrbl: dN; shift: di;
+                               //   calibration: target position (0-based, fractional), fractional shift;
+                               //   baseline: window size, smoothing size)
+   int nc;                     // denoising: size of the Savitzky-Golay filter
+   std::vector<double> coeffs; // denoising: Savitzky-Golay coefficients (nc x nc, column-major)
+   std::vector<int> zones;     // zero: index ranges (1-based), by pairs
+   std::vector<char> sel;      // shift: selected spectra (all if empty)
+};
+
+/* Standard deviation (maximum likelihood, as MASS::fitdistr 'normal') within [n1, n2] (1-based) */
+double _sd_mle (const double *V, int n1, int n2)
+{
+   if (n1<1) n1=1;
+   int n = n2-n1+1;
+   if (n<=0) return 0.0;
+   double m=0.0, s=0.0;
+   for (int i=n1-1; i<n2; i++) m += V[i];
+   m /= n;
+   for (int i=n1-1; i<n2; i++) s += (V[i]-m)*(V[i]-m);
+   return sqrt(s/n);
+}
+
+/* gbaseline (cf. RGbaseline1D) : clipping of the strong negative values, then 2 passes of the
+   baseline estimation; B, W, m1, m2 : scratch buffers of size TD */
+void _stage_gbaseline (const PipeStage &st, double *V, int TD, double *B, double *W, double *m1, double *m2)
+{
+   const double NFAC=1.5, NEGFAC=10;
+   const int NBPASS=2;
+   double sig = _sd_mle(V, st.n1, st.n2);
+
+   // minimum of the mean absolute values over 59 of the 64 blocks
+   double mmoy=DBL_MAX;
+   for (int x=3; x<=61; x++) {
+       double a=(x-1)*TD/64.0, b=x*TD/64.0, s=0.0;
+       int n=0;
+       for (double v=a; v<=b+1e-9; v+=1.0) { int i=(int)v; if (i>=1 && i<=TD) { s += _abs(V[i-1]); n++; } }
+       if (n>0 && s/n<mmoy) mmoy=s/n;
+   }
+   double vmin=DBL_MAX;
+   for (int i=0; i<TD; i++) if (V[i]<vmin) vmin=V[i];
+   if (vmin < -NEGFAC*mmoy) {
+       double vthres=-DBL_MAX;
+       for (int i=0; i<TD; i++) if (V[i]/mmoy < -NEGFAC && V[i]>vthres) vthres=V[i];
+       for (int i=0; i<TD; i++) if (V[i]/mmoy < -NEGFAC) V[i]=vthres;
+   }
+
+   std::copy(V, V+TD, W);
+   for (int i=0; i<TD; i++) B[i]=0.0;
+   std::vector<double> lbn(TD);
+   for (int n=0; n<NBPASS; n++) {
+       _estime_lb(W, TD, st.i1, st.i2, st.p1, st.p2, NFAC*sig, lbn.data(), m1, m2);
+       for (int i=0; i<TD; i++) { W[i] -= lbn[i]; B[i] += lbn[i]; }
+   }
+   for (int i=std::max(st.i1,1)-1; i<st.i2 && i<TD; i++) V[i] -= B[i];
+}
+
+/* baseline (cf. RBaseline1D) : local baseline built from the minimum of each window of p1 points
+   raised by 1.2 sigma of the noise, the pointwise minimum of this step function and of its moving
+   average over p2 points being then low-pass filtered */
+void _stage_baseline (const PipeStage &st, double *V, int TD, double *B, double *W, double *m1)
+{
+   const double ALPHA=0.2;
+   const double CSIG=1.2;
+   int i1 = std::max(st.i1,1)-1, n = std::min(st.i2,TD)-i1;
+   int ws = (int)st.p1, ss = std::min((int)st.p2, (n-1)/2);
+   if (n<3 || ws<1) return;
+   double lsig = CSIG*_sd_mle(V, st.n1, st.n2);
+   double *x = V+i1;
+   for (int w=0; w<n; w+=ws) {
+       int we = std::min(w+ws, n);
+       double m = x[w];
+       for (int j=w+1; j<we; j++) m = std::min(m, x[j]);
+       for (int j=w; j<we; j++) B[j] = m + lsig;
+   }
+   _smooth(B, n, ss, W);
+   for (int j=0; j<n; j++) m1[j] = std::min(B[j], W[j]);
+   _lowpass1(m1, n, ALPHA, W);
+   for (int j=0; j<n; j++) x[j] -= W[j];
+}
+
+/* qnmrbline (cf. Rqnmrbc1D) */
+void _stage_qnmrbl (const PipeStage &st, double *V, int TD, double *B)
+{
+   const int NLOOP=5;
+   const double CSIG=5;
+   double sig = _sd_mle(V, st.n1, st.n2);
+   int i1 = std::max(st.i1,1)-1, n = std::min(st.i2,TD)-i1;
+   if (n<2) return;
+   for (int l=0; l<NLOOP; l++) {
+       _glob_seg(V+i1, n, (int)st.p1, CSIG*sig, B);
+       for (int i=0; i<n; i++) V[i1+i] -= B[i];
+   }
+}
+
+/* denoising (cf. RFilter1D) : Savitzky-Golay filter, the first and last points being filtered
+   by the corresponding rows of the coefficient matrix (as signal::sgolayfilt) */
+void _stage_filter (const PipeStage &st, double *V, int TD, double *B)
+{
+   int i1 = std::max(st.i1,1)-1, len = std::min(st.i2,TD)-i1;
+   int n = st.nc, k = n/2;
+   if (len<n) return;
+   const double *F = st.coeffs.data();
+   const double *x = V+i1;
+   for (int c=0; c<len; c++) {
+       int row, start;
+       if (c<k)            { row=c;           start=0;     }
+       else if (c>=len-k)  { row=n-(len-c);   start=len-n; }
+       else                { row=k;           start=c-k;   }
+       double s=0.0;
+       for (int m=0; m<n; m++) s += F[row + (size_t)m*n]*x[start+m];
+       B[c]=s;
+   }
+   std::copy(B, B+len, V+i1);
+}
+
+/* zero (cf. RZero1D) */
+void _stage_zero (const PipeStage &st, double *V, int TD)
+{
+   for (size_t z=0; z<st.zones.size(); z+=2)
+       for (int i=std::max(st.zones[z],1)-1; i<st.zones[z+1] && i<TD; i++) V[i]=0.0;
+}
+
+/* shift (cf. RShift1D) */
+void _stage_shift (const PipeStage &st, int k, double *V, int TD, double *B)
+{
+   if (st.sel.size()>0 && !st.sel[k]) return;
+   int i1 = st.i1-1, n = st.i2-st.i1+1, di = (int)st.p1;
+   if (n<=0) return;
+   for (int i=0; i<n; i++) { B[i] = (i1+i>=0 && i1+i<TD) ? V[i1+i] : 0.0; if (i1+i>=0 && i1+i<TD) V[i1+i]=0.0; }
+   for (int i=0; i<n; i++) { int j=i1-di+i; if (j>=0 && j<TD) V[j]=B[i]; }
+}
+
+/* calibration (cf. RCalib1D) : the maximum within the reference zone is moved onto the target position
+   p1. By default the shift from the point of the maximum is rounded to an integer number of points (as
+   the previous R code); if p2 != 0, the position of the maximum is refined by the vertex of the parabola
+   through its neighbours and the shift is applied as is by cubic interpolation. The exposed edge points
+   take the value of the nearest edge of the spectrum */
+void _stage_calib (const PipeStage &st, double *V, int TD, double *B)
+{
+   int i1 = std::max(st.i1,1)-1, i2 = std::min(st.i2,TD)-1;
+   if (i2<i1 || TD<4) return;
+   int i0 = i1;
+   for (int i=i1+1; i<=i2; i++) if (V[i]>V[i0]) i0 = i;
+   double pos = i0;
+   if (st.p2!=0 && i0>0 && i0<TD-1) {
+       double den = V[i0-1] - 2*V[i0] + V[i0+1];
+       if (den<0) pos += std::max(-0.5, std::min(0.5, 0.5*(V[i0-1]-V[i0+1])/den));
+   }
+   double d = st.p1 - pos;
+   if (st.p2==0) {
+       int decal = (int)trunc(d);
+       if (_abs(d-decal)>0.5) decal += d>0 ? 1 : -1;
+       if (decal==0) return;
+       std::copy(V, V+TD, B);
+       for (int j=0; j<TD; j++) V[j] = B[std::max(0, std::min(TD-1, j-decal))];
+   } else {
+       if (d==0) return;
+       std::copy(V, V+TD, B);
+       for (int j=0; j<TD; j++)
+           V[j] = _resample_value(B, TD, 0.0, 1.0, std::max(0.0, std::min((double)(TD-1), j-d)), RESAMPLE_CUBIC);
+   }
+}
+
+/* Decode the list of stages (no R API within the threads afterwards) */
+std::vector<PipeStage> _pipeline_decode (List lstages, int n_specs)
+{
+   std::vector<PipeStage> stages(lstages.size());
+   for (int s=0; s<lstages.size(); s++) {
+       List ls(lstages[s]);
+       PipeStage &st = stages[s];
+       std::string type = as<std::string>(ls["type"]);
+       st.type = type=="gbaseline" ? STAGE_GBASELINE : type=="qnmrbl" ? STAGE_QNMRBL :
+                 type=="filter" ? STAGE_FILTER : type=="zero" ? STAGE_ZERO : type=="shift" ? STAGE_SHIFT :
+                 type=="calib" ? STAGE_CALIB : type=="baseline" ? STAGE_BASELINE : 0;
+       if (st.type==0) stop("Unknown pipeline stage: %s", type);
+       st.i1 = ls.containsElementNamed("i1") ? as<int>(ls["i1"]) : 0;
+       st.i2 = ls.containsElementNamed("i2") ? as<int>(ls["i2"]) : 0;
+       st.n1 = st.n2 = 0;
+       if (ls.containsElementNamed("noise")) {
+           NumericVector nz = ls["noise"];
+           st.n1 = (int)nz[0]; st.n2 = (int)nz[1];
+       }
+       st.p1 = ls.containsElementNamed("p1") ? as<double>(ls["p1"]) : 0.0;
+       st.p2 = ls.containsElementNamed("p2") ? as<double>(ls["p2"]) : 0.0;
+       st.nc = 0;
+       if (st.type==STAGE_FILTER) {
+           NumericMatrix F = ls["coeffs"];
+           st.nc = F.nrow();
+           st.coeffs.assign(F.begin(), F.end());
+       }
+       if (st.type==STAGE_ZERO) {
+           NumericMatrix Z = ls["zones"];
+           for (int i=0; i<Z.nrow(); i++) { st.zones.push_back((int)Z(i,0)); st.zones.push_back((int)Z(i,1)); }
+       }
+       if (st.type==STAGE_SHIFT && ls.containsElementNamed("selected") && !Rf_isNull(ls["selected"])) {
+           IntegerVector sel = ls["selected"];
+           st.sel.assign(n_specs, 0);
+           for (int i=0; i<sel.size(); i++) if (sel[i]>=1 && sel[i]<=n_specs) st.sel[sel[i]-1]=1;
+       }
+   }
+   return stages;
+}
+
+/* Chain the stages on the spectrum k (contiguous buffer V); B, W, m1, m2 : work buffers */
+void _pipeline_apply (const std::vector<PipeStage> &stages, int k, double *V, int count_max,
+                      double *B, double *W, double *m1, double *m2)
+{
+   static const char *names[] = { "", "stage gbaseline", "stage qnmrbline", "stage filter", "stage zero", "stage shift",
+                                  "stage calibration", "stage baseline" };
+   for (size_t s=0; s<stages.size(); s++) {
+       const PipeStage &st = stages[s];
+       PerfScope perf(st.type>=1 && st.type<=7 ? names[st.type] : "stage", 8.0*count_max);
+       switch (st.type) {
+           case STAGE_GBASELINE: _stage_gbaseline(st, V, count_max, B, W, m1, m2); break;
+           case STAGE_QNMRBL:    _stage_qnmrbl(st, V, count_max, B); break;
+           case STAGE_FILTER:    _stage_filter(st, V, count_max, B); break;
+           case STAGE_ZERO:      _stage_zero(st, V, count_max); break;
+           case STAGE_SHIFT:     _stage_shift(st, k, V, count_max, B); break;
+           case STAGE_CALIB:     _stage_calib(st, V, count_max, B); break;
+           case STAGE_BASELINE:  _stage_baseline(st, V, count_max, B, W, m1); break;
+       }
+   }
+}
+
+// C_pipeline_run : apply the list of per-spectrum stages to each spectrum in a single pass (one gather /
+//   scatter of each spectrum, the stages being chained on a contiguous buffer), in parallel over the
+//   spectra. The matrix is processed in place if inplace is true, otherwise on a copy. Returns the matrix.
+// [[Rcpp::export]]
+SEXP C_pipeline_run (SEXP x, SEXP l, bool inplace=true)
+{
+   NumericMatrix VV = inplace ? NumericMatrix(x) : clone(NumericMatrix(x));
+   int n_specs = VV.nrow();
+   int count_max = VV.ncol();
+   int k;
+   PerfScope perf("C_pipeline_run", 8.0*n_specs*count_max);
+
+   // Decode the stages before entering the parallel region (no R API within the threads)
+   std::vector<PipeStage> stages = _pipeline_decode(List(l), n_specs);
+
+   double *pV = VV.begin();
+   #pragma omp parallel
+   {
+      std::vector<double> V(count_max), B(count_max), W(count_max), m1(count_max), m2(count_max);
+      #pragma omp for schedule(dynamic,1)
+      for (k=0; k<n_specs; k++) {
+          for (int i=0; i<count_max; i++) V[i] = pV[k + (size_t)i*n_specs];
+          _pipeline_apply(stages, k, V.data(), count_max, B.data(), W.data(), m1.data(), m2.data());
+          for (int i=0; i<count_max; i++) pV[k + (size_t)i*n_specs] = V[i];
+      }
+   }
+   return(VV);
+}
+
+// ---------------------------------------------------
+//  Streaming processing of the spectra store (out-of-core mode) : the spectra are read from the
+//  store by blocks of 'nblock' rows, processed in parallel within the block then written back, so
+//  that the memory used does not depend on the number of spectra. The store is only accessed by
+//  the master thread (positioned file I/O on Windows is not thread-safe).
+// ---------------------------------------------------
+
+/* Read / write the spectra [k0, k0+nk[ from / to the row-major buffer */
+void _store_read_block (SpecStore *st, int k0, int nk, double *buf)
+{
+   for (int r=0; r<nk; r++) st->get(k0+r, 0, st->ncol, buf + (size_t)r*st->ncol);
+}
+
+void _store_write_block (SpecStore *st, int k0, int nk, const double *buf)
+{
+   for (int r=0; r<nk; r++) st->set(k0+r, 0, st->ncol, buf + (size_t)r*st->ncol);
+}
+
+// C_specstore_alloc : create a store of nrow spectra of ncol points, filled with zeros
+// [[Rcpp::export]]
+SEXP C_specstore_alloc (std::string path, int nrow, int ncol)
+{
+   XPtr<SpecStore> ptr(new SpecStore(path, nrow, ncol), true);
+   return ptr;
+}
+
+// C_specstore_rows : the spectra k1 to k2 (1-based, included) as a matrix (1 row = 1 spectrum)
+// [[Rcpp::export]]
+SEXP C_specstore_rows (SEXP p, int k1, int k2)
+{
+   XPtr<SpecStore> st(p);
+   if (k1<1) k1=1;
+   if (k2>st->nrow) k2=st->nrow;
+   int nk = k2>=k1 ? k2-k1+1 : 0;
+   int count_max = st->ncol;
+   NumericMatrix M(nk, count_max);
+   double *pM = M.begin();
+   std::vector<double> row(count_max);
+   for (int r=0; r<nk; r++) {
+       st->get(k1-1+r, 0, count_max, row.data());
+       for (int i=0; i<count_max; i++) pM[r + (size_t)i*nk] = row[i];
+   }
+   return M;
+}
+
+// C_specstore_setrows : write the rows of the matrix x as the spectra from k1 (1-based)
+// [[Rcpp::export]]
+void C_specstore_setrows (SEXP p, int k1, SEXP x)
+{
+   XPtr<SpecStore> st(p);
+   NumericMatrix VV(x);
+   int nk = VV.nrow();
+   int count_max = st->ncol;
+   if (k1<1 || k1-1+nk>st->nrow || VV.ncol()!=count_max) stop("Out of range in the spectra store");
+   const double *pV = VV.begin();
+   std::vector<double> row(count_max);
+   for (int r=0; r<nk; r++) {
+       for (int i=0; i<count_max; i++) row[i] = pV[r + (size_t)i*nk];
+       st->set(k1-1+r, 0, count_max, row.data());
+   }
+}
+
+// C_specstore_pipeline : same as C_pipeline_run, applied to the spectra of the store by blocks of rows
+// [[Rcpp::export]]
+void C_specstore_pipeline (SEXP p, SEXP l, int nblock)
+{
+   XPtr<SpecStore> st(p);
+   int n_specs = st->nrow;
+   int count_max = st->ncol;
+   if (nblock<1) nblock=1;
+   PerfScope perf("C_specstore_pipeline", 2*8.0*n_specs*count_max);
+   std::vector<PipeStage> stages = _pipeline_decode(List(l), n_specs);
+   std::vector<double> buf((size_t)std::min(nblock, n_specs)*count_max);
+
+   for (int k0=0; k0<n_specs; k0+=nblock) {
+       int nk = std::min(nblock, n_specs-k0);
+       _store_read_block(st.get(), k0, nk, buf.data());
+       #pragma omp parallel
+       {
+          std::vector<double> B(count_max), W(count_max), m1(count_max), m2(count_max);
+          #pragma omp for schedule(dynamic,1)
+          for (int r=0; r<nk; r++)
+              _pipeline_apply(stages, k0+r, buf.data() + (size_t)r*count_max, count_max, B.data(), W.data(), m1.data(), m2.data());
+       }
+       _store_write_block(st.get(), k0, nk, buf.data());
+   }
+}
+
+// C_specstore_stats : same as C_noise_stats, over the spectra of the store read by blocks of rows;
+//   the mean spectrum is restricted to the spectra v (1-based) if v is not empty
+// [[Rcpp::export]]
+SEXP C_specstore_stats (SEXP p, int n1, int n2, int flg, IntegerVector v, int nblock)
+{
+   XPtr<SpecStore> st(p);
+   int n_specs = st->nrow;
+   int count_max = st->ncol;
+   if (nblock<1) nblock=1;
+   PerfScope perf("C_specstore_stats", 8.0*n_specs*count_max);
+   std::vector<char> insum(n_specs, v.size()>0 ? 0 : 1);
+   for (int i=0; i<v.size(); i++) if (v[i]>=1 && v[i]<=n_specs) insum[v[i]-1]=1;
+   int nsum=0;
+   for (int k=0; k<n_specs; k++) nsum += insum[k];
+
+   NumericVector vref(count_max);
+   NumericVector Vnoise(n_specs);
+   double *pR = vref.begin();
+   double *pN = Vnoise.begin();
+   std::vector<double> buf((size_t)std::min(nblock, n_specs)*count_max);
+
+   for (int k0=0; k0<n_specs; k0+=nblock) {
+       int nk = std::min(nblock, n_specs-k0);
+       _store_read_block(st.get(), k0, nk, buf.data());
+       // Sum of the rows in row order (reproducible), the columns being shared among the threads
+       #pragma omp parallel for schedule(static)
+       for (int i=0; i<count_max; i++)
+           for (int r=0; r<nk; r++) if (insum[k0+r]) pR[i] += buf[(size_t)r*count_max + i];
+       if (n2>n1) {
+           #pragma omp parallel for schedule(static)
+           for (int r=0; r<nk; r++) pN[k0+r] = _sino_noise(buf.data() + (size_t)r*count_max, n1, n2, flg);
+       }
+   }
+   for (int i=0; i<count_max; i++) pR[i] /= (double)(nsum>0 ? nsum : 1);
+
+   double ynoise = n2>n1 ? _noise_level(pR, n1, n2) : 0.0;
+   List out = List::create(_["vref"] = vref, _["ynoise"] = ynoise, _["vnoise"] = Vnoise);
+   return(out);
+}
+
+// C_specstore_normalize : same as C_spectra_normalize, over the spectra of the store : the reference
+//   (PQN, HIST) is computed by chunks of columns of the zones, then the coefficients by blocks of rows
+//   which are finally divided in place by their coefficient. Returns the coefficients.
+// [[Rcpp::export]]
+SEXP C_specstore_normalize (SEXP p, SEXP z, int meth, int nblock)
+{
+   XPtr<SpecStore> st(p);
+   int n_specs = st->nrow;
+   int count_max = st->ncol;
+   int k, j, npts;
+   if (nblock<1) nblock=1;
+   PerfScope perf("C_specstore_normalize", 2*8.0*n_specs*count_max);
+
+   std::vector<int> zones = _norm_zones(NumericMatrix(z), count_max);
+   std::vector<int> cols;
+   for (size_t i=0; i<zones.size(); i+=2)
+       for (j=zones[i]; j<=zones[i+1]; j++) cols.push_back(j);
+   npts = cols.size();
+
+   NumericVector COEFF(n_specs);
+   double *pC = COEFF.begin();
+   size_t bufsize = (size_t)std::min(nblock, n_specs)*count_max;
+   std::vector<double> buf(bufsize);
+
+   // Reference spectrum for PQN & HIST : median of each point, the columns being gathered by chunks
+   // holding as many values as a block of rows
+   std::vector<double> Vref;
+   if (meth==2 || meth==3) {
+       Vref.resize(npts);
+       int nc = std::max(1, (int)(bufsize/n_specs));
+       for (int c0=0; c0<npts; c0+=nc) {
+           int ncc = std::min(nc, npts-c0);
+           for (k=0; k<n_specs; k++) {
+               // contiguous runs of columns read at once
+               for (int c=c0; c<c0+ncc; ) {
+                   int c1 = c;
+                   while (c1+1<c0+ncc && cols[c1+1]==cols[c1]+1) c1++;
+                   std::vector<double> run(c1-c+1);
+                   st->get(k, cols[c], c1-c+1, run.data());
+                   for (int m=c; m<=c1; m++) buf[(size_t)(m-c0)*n_specs + k] = run[m-c];
+                   c = c1+1;
+               }
+           }
+           #pragma omp parallel for schedule(static)
+           for (int m=0; m<ncc; m++) Vref[c0+m] = _median_select(buf.data() + (size_t)m*n_specs, n_specs);
+       }
+   }
+
+   double wbin=0.01, lmin=0.0;
+   int fac=10, smax=500, nfine=0;
+   std::vector<double> Href;
+   if (meth==3) _hist_reference(Vref, wbin, fac, smax, lmin, nfine, Href);
+
+   // Coefficient of each spectrum (a row of the buffer being a contiguous spectrum)
+   for (int k0=0; k0<n_specs; k0+=nblock) {
+       int nk = std::min(nblock, n_specs-k0);
+       _store_read_block(st.get(), k0, nk, buf.data());
+       #pragma omp parallel for schedule(dynamic,4)
+       for (int r=0; r<nk; r++) {
+           std::vector<double> vals;
+           vals.reserve(npts);
+           pC[k0+r] = _norm_coeff(buf.data() + (size_t)r*count_max, 1, zones, npts, 0, meth, Vref, Href, lmin, wbin, nfine, fac, smax, vals);
+       }
+   }
+   if (meth==1 || meth==4) {
+       double moy=0.0;
+       for (k=0; k<n_specs; k++) moy += pC[k];
+       moy /= n_specs;
+       for (k=0; k<n_specs; k++) pC[k] /= moy;
+   }
+   for (k=0; k<n_specs; k++) if (pC[k]==0.0 || !std::isfinite(pC[k])) pC[k]=1.0;
+
+   // Apply to each spectrum its corresponding coefficient
+   for (int k0=0; k0<n_specs; k0+=nblock) {
+       int nk = std::min(nblock, n_specs-k0);
+       _store_read_block(st.get(), k0, nk, buf.data());
+       #pragma omp parallel for schedule(static)
+       for (int r=0; r<nk; r++) {
+           double *row = buf.data() + (size_t)r*count_max;
+           for (int i=0; i<count_max; i++) row[i] /= pC[k0+r];
+       }
+       _store_write_block(st.get(), k0, nk, buf.data());
+   }
+
+   return(COEFF);
+}
+
+// C_specstore_snr_filter : same as C_buckets_snr_filter, over the spectra of the store read by blocks
+//   of rows through the mapping (no copy); only the SNR of each spectrum within each bucket is kept in memory
+// [[Rcpp::export]]
+SEXP C_specstore_snr_filter (SEXP p, SEXP b, SEXP n, double snr, double prob, int nblock)
+{
+   XPtr<SpecStore> st(p);
+   NumericMatrix Buc(b);
+   NumericVector Vnoise(n);
+   int n_specs = st->nrow;
+   int count_max = st->ncol;
+   int n_bucs = Buc.nrow();
+   int m, nkeep;
+   if (nblock<1) nblock=1;
+   PerfScope perf("C_specstore_snr_filter", 8.0*n_specs*count_max);
+
+   const double *pB = Buc.begin();
+   const double *pN = Vnoise.begin();
+   std::vector<double> S((size_t)n_specs*n_bucs);
+   std::vector<double> buf;
+
+   for (int k0=0; k0<n_specs; k0+=nblock) {
+       int nk = std::min(nblock, n_specs-k0);
+       const double *blk = st->rows(k0, nk, buf);
+       #pragma omp parallel for schedule(static)
+       for (int r=0; r<nk; r++) {
+           const double *row = blk + (size_t)r*count_max;
+           for (int mb=0; mb<n_bucs; mb++) {
+               int n1 = (int)pB[mb], n2 = (int)pB[n_bucs+mb];
+               if (n1<0) n1=0;
+               if (n2>count_max-1) n2=count_max-1;
+               double vmax = row[n1];
+               for (int i=n1+1; i<=n2; i++) if (row[i]>vmax) vmax=row[i];
+               S[(size_t)mb*n_specs + k0+r] = vmax/(2.0*pN[k0+r]);
+           }
+       }
+   }
+
+   std::vector<char> keep(n_bucs, 0);
+   #pragma omp parallel for schedule(dynamic,16)
+   for (m=0; m<n_bucs; m++)
+       keep[m] = quantile_select(S.data() + (size_t)m*n_specs, n_specs, prob) > snr ? 1 : 0;
+
+   nkeep=0;
+   for (m=0; m<n_bucs; m++) nkeep += keep[m];
+   IntegerVector idx(nkeep);
+   nkeep=0;
+   for (m=0; m<n_bucs; m++) if (keep[m]) idx[nkeep++] = m+1;
+   return(idx);
+}
+
+// C_specstore_buckets_dataset : same as C_buckets_dataset, over the spectra of the store read by blocks
+//   of rows; the normalization is then applied on the whole buckets dataset
+// [[Rcpp::export]]
+SEXP C_specstore_buckets_dataset (SEXP p, SEXP ppm, SEXP b, SEXP l, int nblock)
+{
+   XPtr<SpecStore> st(p);
+   NumericMatrix Buc(b);
+   List blist(l);
+   int n_specs = st->nrow;
+   int count_max = st->ncol;
+   int n_bucs = Buc.nrow();
+   int norm = as<int>(blist["norm"]);
+   if (nblock<1) nblock=1;
+   PerfScope perf("C_specstore_buckets_dataset", 8.0*n_specs*count_max);
+   if (NumericVector(ppm).size()!=count_max) stop("The ppm vector does not match the spectra store");
+
+   IntegerMatrix Bidx(n_bucs, 2);
+   BucketsIdx bi = _buckets_index(NumericVector(ppm), Buc, blist, Bidx);
+
+   NumericMatrix M(n_specs, n_bucs);
+   NumericMatrix MaxVals(bi.inoise1<0 ? 0 : n_specs, bi.inoise1<0 ? 0 : n_bucs);
+   NumericVector Vnoise(bi.inoise1<0 ? 0 : n_specs);
+   NumericVector Vref(n_specs);
+
+   const int *pB = Bidx.begin();
+   double *pM = M.begin();
+   double *pMax = MaxVals.begin();
+   double *pNoise = Vnoise.begin();
+   double *pRef = Vref.begin();
+   std::vector<double> buf((size_t)std::min(nblock, n_specs)*count_max);
+
+   for (int k0=0; k0<n_specs; k0+=nblock) {
+       int nk = std::min(nblock, n_specs-k0);
+       _store_read_block(st.get(), k0, nk, buf.data());
+       #pragma omp parallel
+       {
+          std::vector<double> S(count_max);
+          #pragma omp for schedule(static)
+          for (int r=0; r<nk; r++) {
+              int k = k0+r;
+              _buckets_spectrum(buf.data() + (size_t)r*count_max, S.data(), count_max, pB, n_bucs, bi,
+                                pM + k, bi.inoise1>=0 ? pMax + k : NULL, bi.inoise1>=0 ? pNoise + k : NULL, pRef + k, n_specs);
+          }
+       }
+   }
+
+   _buckets_normalize(M, norm, bi, pRef);
+
+   return Rcpp::List::create(_["buckets"] = Bidx,
+                             _["int"] = M,
+                             _["maxvals"] = MaxVals,
+                             _["noise"] = Vnoise );
+}
+
+// ---------------------------------------------------
+//  Synthetic spectra for the benchmarks of the kernels (see doBenchKernels)
+// ---------------------------------------------------
+
+// C_synth_spectra : nspec spectra of 'size' points, sums of Lorentzian lines ('density' lines per 1000 points,
+//   half width at half maximum 'width' points) at the same positions up to a random shift of +/- 'shift'
+//   points, with random intensities and a gaussian noise of standard deviation 'noise'. The first 4% of
+//   the points only contain noise. Returns the absorption (re) and dispersion (im) parts, each matrix
+//   having 1 row = 1 spectrum. The output only depends on the seed, whatever the number of threads.
+// [[Rcpp::export]]
+SEXP C_synth_spectra (int nspec, int size, double density, double width, double shift, double noise, int seed)
+{
+   int npk = std::max(1, (int)round(density*size/1000.0));
+   std::mt19937 gen(seed);
+   std::uniform_real_distribution<double> unif(0.0, 1.0);
+   std::vector<double> pos(npk), amp(npk);
+   for (int j=0; j<npk; j++) {
+       pos[j] = size*(0.05 + 0.9*unif(gen));
+       amp[j] = pow(10.0, 2.0*unif(gen));
+   }
+
+   NumericMatrix Re(nspec, size), Im(nspec, size);
+   double *pRe = Re.begin();
+   double *pIm = Im.begin();
+   int hw = (int)(100*width) + 1;
+
+   #pragma omp parallel for schedule(dynamic,1)
+   for (int k=0; k<nspec; k++) {
+       std::mt19937 g((unsigned)seed*1000003u + (unsigned)k);
+       std::uniform_real_distribution<double> u(0.0, 1.0);
+       std::normal_distribution<double> gauss(0.0, noise>0 ? noise : 1.0);
+       std::vector<double> re(size, 0.0), im(size, 0.0);
+       double fac = 0.8 + 0.4*u(g);
+       for (int j=0; j<npk; j++) {
+           double x0 = pos[j] + shift*(2.0*u(g)-1.0);
+           double a = fac*amp[j]*(0.9 + 0.2*u(g));
+           int i1 = std::max(0, (int)x0 - hw), i2 = std::min(size-1, (int)x0 + hw);
+           for (int i=i1; i<=i2; i++) {
+               double d = i - x0, den = width*width + d*d;
+               re[i] += a*width*width/den;
+               im[i] += a*width*d/den;
+           }
+       }
+       for (int i=0; i<size; i++) {
+           pRe[k + (size_t)i*nspec] = re[i] + (noise>0 ? gauss(g) : 0.0);
+           pIm[k + (size_t)i*nspec] = im[i] + (noise>0 ? gauss(g) : 0.0);
+       }
+   }
+   return List::create(_["re"] = Re, _["im"] = Im);
+}
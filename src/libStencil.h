@@ -0,0 +1,196 @@
+/*
+  ID libStencil.h
+  Copyright (C) 2015-2022 INRAE
+  Authors: D. Jacob
+*/
+
+// ---------------------------------------------------
+//  Stencils and recursive filters shared by the baseline correction, the bucketing (ERVA) and
+//  the phase criteria.
+//  - The 1D variants work on one contiguous spectrum. The stencil loops carry no dependency
+//    between points and are vectorized (omp simd).
+//  - The matrix variants work on a matrix of spectra (1 row = 1 spectrum, column-major as the R
+//    matrices). The points of several spectra at a given column are contiguous, so each thread
+//    handles a block of STENCIL_BLOCK rows and walks the columns. The innermost loop runs over
+//    the spectra of the block and is vectorized, including for the recursive filters (moving sum,
+//    low-pass) whose dependency only runs along the columns.
+// ---------------------------------------------------
+
+#ifndef _LIBSTENCIL_H
+#define _LIBSTENCIL_H
+
+#include <algorithm>
+
+#define STENCIL_BLOCK 64
+
+/* Moving average over 2n+1 points, the window shrinking at the edges (first and last points unchanged) */
+inline void _smooth (const double *V, int N, int n, double *S)
+{
+    if (N<1) return;
+    double Wk=V[0];
+    S[0]=V[0];
+    for (int k=1; k<(N-1); k++) {
+        if (k<=n)              { Wk += (V[2*k]   + V[2*k-1]);    S[k] = Wk/(2*k+1);     }
+        if (k>n && k<=(N-n-1)) { Wk += (V[k+n]   - V[k-n-1]);    S[k] = Wk/(2*n+1);     }
+        if (k>(N-n-1))         { Wk -= (V[2*k-N] - V[2*k-N-1]);  S[k] = Wk/(2*(N-k)+1); }
+    }
+    S[N-1]=V[N-1];
+}
+
+/* First order recursive low-pass filter */
+inline void _lowpass1 (const double *VecIn, int N, double alpha, double *VecOut)
+{
+    if (N<1) return;
+    VecOut[0]=VecIn[0];
+    for (int k=1; k<N; k++) VecOut[k] = VecOut[k-1] + alpha * (VecIn[k] - VecOut[k-1]);
+}
+
+/* 5 points centred derivative (order 4); D[0] = V[1], D[1] = V[1]-V[0], the last 2 points being 0 */
+inline void _derive5 (const double *V, int N, double *D)
+{
+    std::fill(D, D+N, 0.0);
+    if (N<2) return;
+    D[1]=V[1]-V[0]; D[0]=V[1];
+#ifdef _OPENMP
+    #pragma omp simd
+#endif
+    for (int c=2; c<N-2; c++)
+        D[c] = (V[c-2] - 8*V[c-1] + 8*V[c+1] - V[c+2])/12;
+}
+
+/* 11 points smoothed derivative computed for the points c1 to c2 (included), 0 elsewhere */
+inline void _derive11 (const double *V, int N, int c1, int c2, double *D)
+{
+    std::fill(D, D+N, 0.0);
+    c1 = std::max(c1, 5); c2 = std::min(c2, N-6);
+#ifdef _OPENMP
+    #pragma omp simd
+#endif
+    for (int c=c1; c<=c2; c++)
+        D[c] = (42*(V[c+1]-V[c-1]) +
+                48*(V[c+2]-V[c-2]) +
+                27*(V[c+3]-V[c-3]) +
+                 8*(V[c+4]-V[c-4]) +
+                    V[c+5]-V[c-5] )/512;
+}
+
+/* Second derivative of a Lorentzian of width sigma, evaluated at each point of X */
+inline void _sdl (const double *X, int N, double sigma, double *Out)
+{
+    double v2 = sigma*sigma;
+#ifdef _OPENMP
+    #pragma omp simd
+#endif
+    for (int n=0; n<N; n++) {
+        double v1 = X[n]*X[n], t = 4.0*v1 + v2;
+        Out[n] = (12.0*v1 - v2)/(t*t*t);
+    }
+}
+
+/* Apply f(k1, k2) to the blocks [k1, k2[ of the nr rows, in parallel */
+template <class F>
+void _stencil_blocks (int nr, F f)
+{
+    int nb = (nr + STENCIL_BLOCK - 1)/STENCIL_BLOCK, b;
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for (b=0; b<nb; b++) f(b*STENCIL_BLOCK, std::min(nr, (b+1)*STENCIL_BLOCK));
+}
+
+/* _smooth applied to each row of the matrix X (nr x N) */
+inline void _smooth_rows (const double *X, int nr, int N, int n, double *S)
+{
+    if (N<1) return;
+    _stencil_blocks(nr, [=](int k1, int k2) {
+        double W[STENCIL_BLOCK];
+        int nk = k2-k1;
+        const double *x = X + k1;
+        double *s = S + k1;
+        #define _XI(i) (x + (size_t)(i)*nr)
+#ifdef _OPENMP
+        #pragma omp simd
+#endif
+        for (int r=0; r<nk; r++) { W[r] = _XI(0)[r]; s[r] = W[r]; }
+        for (int k=1; k<(N-1); k++) {
+            double *sk = s + (size_t)k*nr;
+            if (k<=n) {
+                const double *a = _XI(2*k), *b = _XI(2*k-1);
+                double d = 2*k+1;
+#ifdef _OPENMP
+                #pragma omp simd
+#endif
+                for (int r=0; r<nk; r++) { W[r] += a[r] + b[r]; sk[r] = W[r]/d; }
+            }
+            if (k>n && k<=(N-n-1)) {
+                const double *a = _XI(k+n), *b = _XI(k-n-1);
+                double d = 2*n+1;
+#ifdef _OPENMP
+                #pragma omp simd
+#endif
+                for (int r=0; r<nk; r++) { W[r] += a[r] - b[r]; sk[r] = W[r]/d; }
+            }
+            if (k>(N-n-1)) {
+                const double *a = _XI(2*k-N), *b = _XI(2*k-N-1);
+                double d = 2*(N-k)+1;
+#ifdef _OPENMP
+                #pragma omp simd
+#endif
+                for (int r=0; r<nk; r++) { W[r] -= a[r] - b[r]; sk[r] = W[r]/d; }
+            }
+        }
+        double *sl = s + (size_t)(N-1)*nr;
+        const double *xl = _XI(N-1);
+        for (int r=0; r<nk; r++) sl[r] = xl[r];
+        #undef _XI
+    });
+}
+
+/* _lowpass1 applied to each row of the matrix X (nr x N) */
+inline void _lowpass1_rows (const double *X, int nr, int N, double alpha, double *Y)
+{
+    if (N<1) return;
+    _stencil_blocks(nr, [=](int k1, int k2) {
+        int nk = k2-k1;
+        const double *x = X + k1;
+        double *y = Y + k1;
+        for (int r=0; r<nk; r++) y[r] = x[r];
+        for (int k=1; k<N; k++) {
+            const double *xk = x + (size_t)k*nr;
+            const double *yp = y + (size_t)(k-1)*nr;
+            double *yk = y + (size_t)k*nr;
+#ifdef _OPENMP
+            #pragma omp simd
+#endif
+            for (int r=0; r<nk; r++) yk[r] = yp[r] + alpha*(xk[r] - yp[r]);
+        }
+    });
+}
+
+/* _derive5 applied to each row of the matrix X (nr x N) */
+inline void _derive5_rows (const double *X, int nr, int N, double *D)
+{
+    _stencil_blocks(nr, [=](int k1, int k2) {
+        int nk = k2-k1;
+        const double *x = X + k1;
+        double *d = D + k1;
+        #define _XI(i) (x + (size_t)(i)*nr)
+        #define _DI(i) (d + (size_t)(i)*nr)
+        for (int c=0; c<N; c++) std::fill(_DI(c), _DI(c)+nk, 0.0);
+        if (N>=2) {
+            for (int r=0; r<nk; r++) { _DI(1)[r] = _XI(1)[r] - _XI(0)[r]; _DI(0)[r] = _XI(1)[r]; }
+        }
+        for (int c=2; c<N-2; c++) {
+            const double *a = _XI(c-2), *b = _XI(c-1), *e = _XI(c+1), *f = _XI(c+2);
+            double *dc = _DI(c);
+#ifdef _OPENMP
+            #pragma omp simd
+#endif
+            for (int r=0; r<nk; r++) dc[r] = (a[r] - 8*b[r] + 8*e[r] - f[r])/12;
+        }
+        #undef _XI
+        #undef _DI
+    });
+}
+
+#endif